@@ -0,0 +1,65 @@
+// Refit against rebuild of a Linear_BVH over moving spheres.
+// Moves a share of the spheres of a random field (Sphere::set_center), then times Linear_BVH::refit against
+// building a new tree over the moved spheres and compares their SAH costs. Then lets every sphere drift
+// for a number of frames through Linear_BVH::update, printing the cost growth and whether it rebuilt.
+//
+// Run: build/Refit_Bench [sphere_count] [drift_per_frame]
+
+#include "utility.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    int sphere_count = argc > 1 ? std::stoi(argv[1]) : 100000;
+    double drift = argc > 2 ? std::stod(argv[2]) : 0.3;
+
+    random_seed(1);
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    std::vector<shared_ptr<Sphere>> spheres;
+    hittable_list list;
+    double extent = std::cbrt(double(sphere_count)) * 2; //about one sphere per 8 cubic units
+    for (int i = 0; i < sphere_count; i++) {
+        auto sphere = make_shared<Sphere>(random_vector(-extent / 2, extent / 2), random_double(0.1, 0.5), mat);
+        spheres.push_back(sphere);
+        list.add(sphere);
+    }
+    bvh_build_options options;
+    options.split_method = bvh_split_method::sah;
+    Linear_BVH bvh(list, options);
+
+    //1% of the spheres move up to one unit
+    for (int i = 0; i < sphere_count / 100; i++) {
+        auto& sphere = spheres[random_int(0, sphere_count - 1)];
+        sphere->set_center(sphere->get_center() + random_vector(-1, 1));
+    }
+    auto start = std::chrono::steady_clock::now();
+    bvh.refit();
+    double refit_time = milliseconds_since(start);
+    start = std::chrono::steady_clock::now();
+    Linear_BVH fresh(list, options);
+    double build_time = milliseconds_since(start);
+    std::cout << "1% moved: refit " << refit_time << " ms, rebuild " << build_time << " ms, SAH cost "
+              << bvh.sah_cost(options.traversal_cost) << " refit vs " << fresh.sah_cost(options.traversal_cost) << " rebuilt\n";
+
+    //every sphere drifts each frame, update rebuilds once the cost has grown too much
+    for (int frame = 1; frame <= 25; frame++) {
+        for (auto& sphere : spheres)
+            sphere->set_center(sphere->get_center() + random_vector(-drift, drift));
+        start = std::chrono::steady_clock::now();
+        bool rebuilt = bvh.update();
+        double update_time = milliseconds_since(start);
+        std::cout << "frame " << frame << ": " << (rebuilt ? "rebuilt" : "refit") << " in " << update_time << " ms, SAH cost "
+                  << bvh.sah_cost(options.traversal_cost) << " (built at " << bvh.build_sah_cost() << ")\n";
+    }
+}
@@ -0,0 +1,101 @@
+// Convergence of the samplers in sampler.h on the Cornell box.
+// Renders a reference with many independent samples, then each sampler at 1, 2, 4, ... samples per pixel,
+// and prints the RMSE of each render against the reference, on linear values. (Display values are no good
+// here: at low sample counts, gamma and clamping bias noisy pixels dark, which hides the noise itself.)
+//
+// Run: build/Sampler_Bench [width] [max_spp] [reference_spp]
+
+#include "utility.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "quad.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static hittable_list cornell_box()
+{
+    hittable_list world;
+
+    auto red   = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_shared<emissive>(color(15, 15, 15));
+
+    world.add(make_shared<quad>(point3(555,0,0), Vec3(0,555,0), Vec3(0,0,555), green));
+    world.add(make_shared<quad>(point3(0,0,0), Vec3(0,555,0), Vec3(0,0,555), red));
+    world.add(make_shared<quad>(point3(343, 554, 332), Vec3(-130,0,0), Vec3(0,0,-105), light));
+    world.add(make_shared<quad>(point3(0,0,0), Vec3(555,0,0), Vec3(0,0,555), white));
+    world.add(make_shared<quad>(point3(555,555,555), Vec3(-555,0,0), Vec3(0,0,-555), white));
+    world.add(make_shared<quad>(point3(0,0,555), Vec3(555,0,0), Vec3(0,555,0), white));
+    world.add(box(point3(130, 0, 65), point3(295, 165, 230), white));
+    world.add(box(point3(265, 0, 295), point3(430, 330, 460), white));
+    return world;
+}
+
+// renders through a temporary .raw file and returns the linear values
+static std::vector<float> render(const hittable& world, int width, int spp, shared_ptr<sampler> pixel_sampler, uint64_t seed)
+{
+    Camera cam;
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = width;
+    cam.samples_per_pixel = spp;
+    cam.max_depth         = 50;
+    cam.background        = color(0,0,0);
+    cam.vfov     = 40;
+    cam.position = point3(278, 278, -800);
+    cam.direction   = point3(278, 278, 0);
+    cam.up      = Vec3(0,1,0);
+    cam.telemetry_json = true;
+    cam.telemetry_interval = 1e9;
+    cam.seed = seed;
+    cam.pixel_sampler = pixel_sampler;
+    cam.output_path = "sampler_bench.raw";
+    cam.render(world);
+
+    std::ifstream in(cam.output_path, std::ios::binary);
+    in.seekg(16);
+    std::vector<float> rgb(size_t(width) * width * 3);
+    in.read(reinterpret_cast<char*>(rgb.data()), std::streamsize(rgb.size() * sizeof(float)));
+    std::remove(cam.output_path.c_str());
+    return rgb;
+}
+
+int main(int argc, char** argv)
+{
+    int width = argc > 1 ? std::stoi(argv[1]) : 128;
+    int max_spp = argc > 2 ? std::stoi(argv[2]) : 256;
+    int reference_spp = argc > 3 ? std::stoi(argv[3]) : 8192;
+
+    hittable_list world = cornell_box();
+    std::vector<float> reference = render(world, width, reference_spp, make_shared<independent_sampler>(), 12345);
+
+    const char* names[] = { "independent", "stratified", "halton", "sobol", "bluenoise" };
+    double seconds[std::size(names)] = {};
+    std::printf("RMSE x 1000 against %d spp, %d x %d\n%6s", reference_spp, width, width, "spp");
+    for (const char* name : names)
+        std::printf(" %12s", name);
+    std::printf("\n");
+
+    for (int spp = 1; spp <= max_spp; spp *= 2) {
+        std::printf("%6d", spp);
+        for (size_t s = 0; s < std::size(names); s++) {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<float> image = render(world, width, spp, make_sampler(names[s], spp), 0);
+            seconds[s] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            double squares = 0;
+            for (size_t k = 0; k < image.size(); k++)
+                squares += double(image[k] - reference[k]) * (image[k] - reference[k]);
+            std::printf(" %12.2f", 1000 * std::sqrt(squares / image.size()));
+            std::fflush(stdout);
+        }
+        std::printf("\n");
+    }
+    std::printf("%6s", "time");
+    for (double time : seconds)
+        std::printf(" %11.2fs", time);
+    std::printf("\n");
+}
@@ -0,0 +1,153 @@
+// Microbenchmark of the triangle intersection kernels.
+// Compares the watertight kernel in triangle.h against the previous plane + barycentric test,
+// in rays/s on a triangle soup, and counts rays lost through the shared edges of a triangle grid.
+//
+// Run: build/Triangle_Bench [ray_count]
+
+#include "utility.h"
+#include "hittable.h"
+#include "triangle.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// The kernel Triangle::hit used before: intersect the plane, then three cross products
+// and three divisions for the barycentric coordinates, and a tolerance test for parallel rays.
+inline bool plane_triangle_intersect(const Ray& r, const interval& ray_t, const point3& a, const point3& b, const point3& c,
+                                     const Vec3& normal, double& t, double& alpha, double& beta, double& upsilon)
+{
+    if (cmpfloat(dot(r.direction, normal), 0))
+        return false;
+
+    auto collision_time = dot(a - r.origin, normal) / dot(r.direction, normal);
+    if (!ray_t.contains(collision_time))
+        return false;
+    auto p = r.at(collision_time);
+
+    alpha = dot(normal, cross(c - b, p - b)) / normal.length_squared();
+    beta = dot(normal, cross(a - c, p - c)) / normal.length_squared();
+    upsilon = dot(normal, cross(b - a, p - a)) / normal.length_squared();
+
+    if (alpha < 0 || beta < 0 || upsilon < 0)
+        return false;
+
+    t = collision_time;
+    return true;
+}
+
+struct bench_triangle {
+    point3 a, b, c;
+    Vec3 normal;
+
+    bench_triangle(const point3& a, const point3& b, const point3& c) : a(a), b(b), c(c), normal(cross(b - a, c - a)) {}
+};
+
+template <typename Kernel>
+static void run(const std::string& name, const std::vector<bench_triangle>& triangles, const std::vector<Ray>& rays, Kernel kernel)
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t hits = 0;
+    double checksum = 0;
+    for (const auto& r : rays) {
+        for (const auto& tri : triangles) {
+            double t, alpha, beta, upsilon;
+            if (kernel(r, tri, t, alpha, beta, upsilon)) {
+                hits++;
+                checksum += alpha;
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double tests = double(rays.size()) * triangles.size();
+
+    std::cout << name << ": " << tests / seconds / 1e6 << " M ray-triangle tests/s, "
+              << hits << " hits (checksum " << checksum << ")\n";
+}
+
+int main(int argc, char** argv)
+{
+    size_t ray_count = argc > 1 ? std::stoul(argv[1]) : 20000;
+
+    // a soup of random triangles inside the unit cube, and rays from around it
+    std::vector<bench_triangle> triangles;
+    for (int i = 0; i < 64; i++) {
+        point3 center = random_vector(-1, 1);
+        bench_triangle tri = { center + random_vector(-0.3, 0.3), center + random_vector(-0.3, 0.3), center + random_vector(-0.3, 0.3) };
+        triangles.push_back(tri);
+    }
+
+    std::vector<Ray> rays;
+    for (size_t i = 0; i < ray_count; i++) {
+        point3 origin = 3 * random_unit_vector();
+        rays.push_back(Ray(origin, random_vector(-0.5, 0.5) - origin));
+    }
+
+    auto interval_all = interval(0.001, infinity);
+
+    run("plane + barycentric", triangles, rays, [&](const Ray& r, const bench_triangle& tri, double& t, double& alpha, double& beta, double& upsilon) {
+        return plane_triangle_intersect(r, interval_all, tri.a, tri.b, tri.c, tri.normal, t, alpha, beta, upsilon);
+    });
+
+    // ray setup redone for every test, as in Triangle::hit
+    run("watertight (setup per test)", triangles, rays, [&](const Ray& r, const bench_triangle& tri, double& t, double& alpha, double& beta, double& upsilon) {
+        return triangle_intersect(triangle_ray(r), interval_all, tri.a, tri.b, tri.c, t, alpha, beta, upsilon);
+    });
+
+    // ray setup shared across triangles, as in Triangle_Mesh
+    {
+        std::vector<triangle_ray> prepared(rays.begin(), rays.end());
+        auto start = std::chrono::steady_clock::now();
+        size_t hits = 0;
+        for (const auto& ray : prepared) {
+            for (const auto& tri : triangles) {
+                double t, alpha, beta, upsilon;
+                hits += triangle_intersect(ray, interval_all, tri.a, tri.b, tri.c, t, alpha, beta, upsilon);
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "watertight (setup per ray): " << double(rays.size()) * triangles.size() / seconds / 1e6
+                  << " M ray-triangle tests/s, " << hits << " hits\n";
+    }
+
+    // Watertightness: a grid of triangles sharing edges and vertices, hit by rays aimed exactly
+    // at the shared edges. Any ray that finds no triangle slipped through a crack.
+    const int grid = 16;
+    std::vector<bench_triangle> surface;
+    auto grid_point = [&](int i, int j) { return point3(i * 0.1, j * 0.1, 0.05 * std::sin(i * 0.7 + j * 0.3)); };
+    for (int i = 0; i < grid; i++) {
+        for (int j = 0; j < grid; j++) {
+            bench_triangle lower = { grid_point(i, j), grid_point(i + 1, j), grid_point(i + 1, j + 1) };
+            bench_triangle upper = { grid_point(i, j), grid_point(i + 1, j + 1), grid_point(i, j + 1) };
+            surface.push_back(lower);
+            surface.push_back(upper);
+        }
+    }
+
+    size_t cracks_plane = 0, cracks_watertight = 0, edge_rays = 0;
+    for (size_t n = 0; n < ray_count; n++) {
+        //a point on an interior edge (the diagonal or a grid line) or an interior vertex
+        int i = random_int(1, grid - 1), j = random_int(1, grid - 1);
+        double s = random_double();
+        int kind = random_int(0, 2);
+        point3 target = (kind == 0) ? grid_point(i, j) + s * (grid_point(i + 1, j + 1) - grid_point(i, j))
+                      : (kind == 1) ? grid_point(i, j) + s * (grid_point(i + 1, j) - grid_point(i, j))
+                                    : grid_point(i, j);
+        point3 origin = target + Vec3(random_double(-1, 1), random_double(-1, 1), 2);
+        Ray r(origin, target - origin);
+        edge_rays++;
+
+        bool hit_plane = false, hit_watertight = false;
+        triangle_ray prepared(r);
+        for (const auto& tri : surface) {
+            double t, alpha, beta, upsilon;
+            hit_plane |= plane_triangle_intersect(r, interval_all, tri.a, tri.b, tri.c, tri.normal, t, alpha, beta, upsilon);
+            hit_watertight |= triangle_intersect(prepared, interval_all, tri.a, tri.b, tri.c, t, alpha, beta, upsilon);
+        }
+        cracks_plane += !hit_plane;
+        cracks_watertight += !hit_watertight;
+    }
+
+    std::cout << "rays through shared edges/vertices: " << edge_rays << ", lost by plane + barycentric: " << cracks_plane
+              << ", lost by watertight: " << cracks_watertight << "\n";
+}
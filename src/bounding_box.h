@@ -48,31 +48,21 @@ class Bounding_Box {
     bool hit(const Ray& r, interval ray_t) const
     {
         const point3& ray_origin = r.origin;
-        const Vec3& ray_dir = r.direction;
 
         //for each coordinate
         for (int i = 0; i < 3; i++)
         {
-            //check if intersection and get times
+            //check if intersection and get times. The ray's sign picks which plane it enters through.
             const interval& axis = axis_interval(i);
-            const double axis_direction_inv = 1.0 / ray_dir[i];
-
-            double hit_time_1 = (axis.min - ray_origin[i]) * axis_direction_inv;
-            double hit_time_2 = (axis.max - ray_origin[i]) * axis_direction_inv;
-
-            // if hit1 = entering, hit2 = leaving
-            if (hit_time_1 < hit_time_2)
-            {
-                // tighten ray_t for points in this bounding box
-                if (hit_time_1 > ray_t.min) ray_t.min = hit_time_1;
-                if (hit_time_2 < ray_t.max) ray_t.max = hit_time_2;
-            }
-            else // if hit2 = entering, hit1 = leaving
-            {
-                // tighten ray_t for points in this bounding box
-                if (hit_time_2 > ray_t.min) ray_t.min = hit_time_2;
-                if (hit_time_1 < ray_t.max) ray_t.max = hit_time_1;
-            }
+            const double entering = r.dir_is_neg[i] ? axis.max : axis.min;
+            const double leaving = r.dir_is_neg[i] ? axis.min : axis.max;
+
+            double hit_time_1 = (entering - ray_origin[i]) * r.inv_direction[i];
+            double hit_time_2 = (leaving - ray_origin[i]) * r.inv_direction[i];
+
+            // tighten ray_t for points in this bounding box
+            if (hit_time_1 > ray_t.min) ray_t.min = hit_time_1;
+            if (hit_time_2 < ray_t.max) ray_t.max = hit_time_2;
 
             if (ray_t.max <= ray_t.min)
                 return false;
@@ -82,6 +72,18 @@ class Bounding_Box {
         return true;
     }
 
+    // Returns the surface area of the box, or 0 for an empty box
+    double surface_area() const {
+        if (x.size() < 0 || y.size() < 0 || z.size() < 0)
+            return 0;
+        return 2 * (x.size()*y.size() + y.size()*z.size() + z.size()*x.size());
+    }
+
+    // Returns the center point of the box
+    point3 centroid() const {
+        return point3(0.5*(x.min + x.max), 0.5*(y.min + y.max), 0.5*(z.min + z.max));
+    }
+
     // Returns the index of the longest axis of the bounding box
     int longest_axis() const {
         if (x.size() > y.size())
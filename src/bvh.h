@@ -6,27 +6,300 @@
 
 #include <algorithm>
 
+//strategy used to split a set of objects into two BVH children
+enum class bvh_split_method {
+    median, //sort on the longest axis and split the objects in half
+    sah     //binned surface area heuristic
+};
+
+//what a traversal looks for
+enum class bvh_query {
+    closest,    //nearest hit, shrinking the interval as hits are found
+    any         //first hit found, for occlusion tests
+};
+
+//tuning knobs for BVH construction
+struct bvh_build_options {
+    bvh_split_method split_method = bvh_split_method::median;
+    int bin_count = 16;             //number of centroid bins evaluated per SAH split
+    int max_leaf_size = 4;          //largest number of objects a SAH leaf may hold
+    double traversal_cost = 0.125;  //cost of visiting a node, relative to one object intersection
+};
+
+//ranges with at least this many objects are binned, partitioned and built as subtrees in parallel
+const size_t bvh_parallel_grain = 4096;
+
+//number of chunks a parallel pass over count objects is split into. It depends only on count,
+//so the tree that gets built does not depend on the number of threads.
+inline size_t bvh_chunk_count(size_t count) {
+    return std::max<size_t>(1, std::min<size_t>(count / bvh_parallel_grain, 64));
+}
+
+//Runs fn(chunk) for every chunk in [0, chunk_count). With more than one chunk the calls
+//run as OpenMP tasks, and all of them have finished when this returns.
+template <typename ChunkFn>
+inline void bvh_for_each_chunk(size_t chunk_count, ChunkFn fn) {
+    if (chunk_count == 1) {
+        fn(size_t(0));
+        return;
+    }
+
+    #pragma omp taskloop default(shared)
+    for (size_t chunk = 0; chunk < chunk_count; chunk++)
+        fn(chunk);
+}
+
+//a SAH split candidate: objects whose centroid falls in a bin <= bin go left.
+struct bvh_sah_split {
+    int axis = -1;      //-1 when no split beats keeping the objects together
+    int bin = 0;
+    int bin_count = 0;
+    double axis_min = 0;
+    double bin_scale = 0;
+    double cost = infinity;
+
+    int bin_of(const point3& centroid) const {
+        int b = int((centroid[axis] - axis_min) * bin_scale);
+        return b < 0 ? 0 : (b >= bin_count ? bin_count - 1 : b);
+    }
+
+    bool goes_left(const point3& centroid) const {
+        return bin_of(centroid) <= bin;
+    }
+};
+
+//Bins the object centroids along the widest centroid axis and sweeps every bin boundary,
+//returning the cheapest split. Costs are relative to the parent box, one unit per object intersection.
+//box_at(i) returns the bounding box of the i-th of count objects.
+template <typename BoxAt>
+bvh_sah_split find_sah_split(size_t count, BoxAt box_at, const Bounding_Box& bounds, const bvh_build_options& options)
+{
+    bvh_sah_split split;
+
+    //large ranges are binned in chunks (as OpenMP tasks) and the per-chunk results merged
+    const size_t chunk_count = bvh_chunk_count(count);
+    auto chunk_begin = [&](size_t chunk) { return count * chunk / chunk_count; };
+
+    //bounds of the centroids (built from raw intervals so no minimum padding is applied)
+    std::vector<Bounding_Box> chunk_centroid_bounds(chunk_count, Bounding_Box::empty);
+    bvh_for_each_chunk(chunk_count, [&](size_t chunk) {
+        Bounding_Box& bounds_of_chunk = chunk_centroid_bounds[chunk];
+        for (size_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++) {
+            point3 c = box_at(i).centroid();
+            bounds_of_chunk.x = interval(bounds_of_chunk.x, interval(c.x, c.x));
+            bounds_of_chunk.y = interval(bounds_of_chunk.y, interval(c.y, c.y));
+            bounds_of_chunk.z = interval(bounds_of_chunk.z, interval(c.z, c.z));
+        }
+    });
+
+    Bounding_Box centroid_bounds = Bounding_Box::empty;
+    for (const auto& chunk_bounds : chunk_centroid_bounds)
+        centroid_bounds = Bounding_Box(centroid_bounds, chunk_bounds);
+
+    int axis = centroid_bounds.longest_axis();
+    const interval& extent = centroid_bounds.axis_interval(axis);
+    //every centroid sits on the same plane, binning cannot separate them
+    if (extent.size() <= 1e-12)
+        return split;
+
+    const int bin_count = std::max(2, options.bin_count);
+
+    split.axis = axis;
+    split.bin_count = bin_count;
+    split.axis_min = extent.min;
+    split.bin_scale = bin_count / extent.size();
+
+    std::vector<Bounding_Box> chunk_bin_boxes(chunk_count * bin_count, Bounding_Box::empty);
+    std::vector<size_t> chunk_bin_counts(chunk_count * bin_count, 0);
+    bvh_for_each_chunk(chunk_count, [&](size_t chunk) {
+        Bounding_Box* boxes_of_chunk = &chunk_bin_boxes[chunk * bin_count];
+        size_t* counts_of_chunk = &chunk_bin_counts[chunk * bin_count];
+        for (size_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++) {
+            Bounding_Box b = box_at(i);
+            int bin = split.bin_of(b.centroid());
+            boxes_of_chunk[bin] = Bounding_Box(boxes_of_chunk[bin], b);
+            counts_of_chunk[bin]++;
+        }
+    });
+
+    std::vector<Bounding_Box> bin_boxes(bin_count, Bounding_Box::empty);
+    std::vector<size_t> bin_counts(bin_count, 0);
+    for (size_t chunk = 0; chunk < chunk_count; chunk++) {
+        for (int bin = 0; bin < bin_count; bin++) {
+            bin_boxes[bin] = Bounding_Box(bin_boxes[bin], chunk_bin_boxes[chunk * bin_count + bin]);
+            bin_counts[bin] += chunk_bin_counts[chunk * bin_count + bin];
+        }
+    }
+
+    //sweep right to left, storing area*count of everything to the right of each boundary
+    std::vector<double> right_cost(bin_count, 0);
+    Bounding_Box right_box = Bounding_Box::empty;
+    size_t right_count = 0;
+    for (int b = bin_count - 1; b > 0; b--) {
+        right_box = Bounding_Box(right_box, bin_boxes[b]);
+        right_count += bin_counts[b];
+        right_cost[b - 1] = right_box.surface_area() * right_count;
+    }
+
+    //sweep left to right, evaluating the split after each bin
+    double inv_area = 1.0 / std::max(bounds.surface_area(), 1e-300);
+    Bounding_Box left_box = Bounding_Box::empty;
+    size_t left_count = 0;
+    split.axis = -1;
+    for (int b = 0; b < bin_count - 1; b++) {
+        left_box = Bounding_Box(left_box, bin_boxes[b]);
+        left_count += bin_counts[b];
+        if (left_count == 0 || left_count == count)
+            continue;
+
+        double cost = options.traversal_cost + (left_box.surface_area() * left_count + right_cost[b]) * inv_area;
+        if (cost < split.cost) {
+            split.cost = cost;
+            split.bin = b;
+            split.axis = axis;
+        }
+    }
+
+    return split;
+}
+
 //node in BVH
 class BVH_Node : public hittable {
 
     public:
-    BVH_Node(hittable_list list) : BVH_Node(list.objects, 0, list.objects.size()) {}
+    //builds over the list's objects in place (reordering them) instead of copying the list
+    BVH_Node(hittable_list& list, const bvh_build_options& options = bvh_build_options())
+    : BVH_Node(list.objects, 0, list.objects.size(), options) {}
+
+    BVH_Node(hittable_list&& list, const bvh_build_options& options = bvh_build_options())
+    : BVH_Node(list, options) {}
 
     //start = first object included from objects vector
     //end = last object included from objects vector
-    BVH_Node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
+    //Large trees are built in parallel, the two subtrees of a big enough range as separate OpenMP tasks.
+    BVH_Node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+             const bvh_build_options& options = bvh_build_options()) {
+        if (omp_in_parallel()) {
+            build(objects, start, end, options);
+            return;
+        }
+
+        #pragma omp parallel default(shared) if(end - start >= bvh_parallel_grain)
+        #pragma omp single
+        build(objects, start, end, options);
+    }
+
+    bool hit(const Ray& r, interval ray_t, hit_record& rec) const override {
+
+        //check if hits this bounding box
+        if (!bbox.hit(r, ray_t))
+        {
+            return false;
+        }
+
+        //leaf holding several objects, test them all like a hittable_list
+        if (!leaf_objects.empty())
+        {
+            bool hit_anything = false;
+            for (const auto& object : leaf_objects) {
+                if (object->hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+            return hit_anything;
+        }
+
+        //visit the child nearer along the split axis first, so a hit there culls the farther one
+        const auto& near_child = r.dir_is_neg[axis] ? right : left;
+        const auto& far_child = r.dir_is_neg[axis] ? left : right;
+
+        bool hit_near = near_child->hit(r, ray_t, rec);
+        //only check times sooner than when we hit the near child, if we did.
+        bool hit_far = far_child->hit(r, interval(ray_t.min, hit_near ? rec.t : ray_t.max), rec);
+
+        return (hit_near || hit_far);
+
+    }
+
+    bool occluded(const Ray& r, interval ray_t) const override {
+        if (!bbox.hit(r, ray_t))
+            return false;
+
+        if (!leaf_objects.empty()) {
+            for (const auto& object : leaf_objects) {
+                if (object->occluded(r, ray_t))
+                    return true;
+            }
+            return false;
+        }
+
+        return left->occluded(r, ray_t) || right->occluded(r, ray_t);
+    }
+
+    void collect_lights(std::vector<const hittable*>& lights) const override {
+        for (const auto& object : leaf_objects)
+            object->collect_lights(lights);
+        if (leaf_objects.empty()) {
+            left->collect_lights(lights);
+            if (right != left)
+                right->collect_lights(lights);
+        }
+    }
+
+    Bounding_Box bounding_box() const override {return bbox;}
+
+    //Expected cost of a ray query against this subtree under the surface area heuristic.
+    //Each object intersection costs 1 and each node visit costs traversal_cost,
+    //so trees from different builders can be compared directly.
+    double sah_cost(double traversal_cost = bvh_build_options().traversal_cost) const {
+        if (!leaf_objects.empty())
+            return double(leaf_objects.size());
+
+        double inv_area = 1.0 / std::max(bbox.surface_area(), 1e-300);
+        return traversal_cost
+             + child_sah_cost(left, traversal_cost) * left->bounding_box().surface_area() * inv_area
+             + child_sah_cost(right, traversal_cost) * right->bounding_box().surface_area() * inv_area;
+    }
+
+    private:
+    shared_ptr<hittable> left;
+    shared_ptr<hittable> right;
+    std::vector<shared_ptr<hittable>> leaf_objects; //only set for SAH leaves
+    Bounding_Box bbox;
+    int axis = 0;   //axis the children were split along, left holds the lower side
+
+    void build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, const bvh_build_options& options) {
         //build a bounding box with span of the source objects
         bbox = Bounding_Box::empty;
         for (size_t object_index=start; object_index < end; object_index++)
             bbox = Bounding_Box(bbox, objects[object_index]->bounding_box());
 
-        int axis = bbox.longest_axis();
+        if (options.split_method == bvh_split_method::sah)
+            build_sah(objects, start, end, options);
+        else
+            build_median(objects, start, end, options);
+    }
+
+    //builds the two children, the left one as a separate task when the range is large
+    void build_children(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t mid, size_t end, const bvh_build_options& options) {
+        #pragma omp task default(shared) if(end - start >= bvh_parallel_grain)
+        left = make_shared<BVH_Node>(objects, start, mid, options);
+
+        right = make_shared<BVH_Node>(objects, mid, end, options);
 
-    
-        // Compares objects along each axis, where being smaller along an axis 
+        #pragma omp taskwait
+    }
+
+    //original builder: split at the median along the longest axis
+    void build_median(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, const bvh_build_options& options) {
+        axis = bbox.longest_axis();
+
+
+        // Compares objects along each axis, where being smaller along an axis
         // means your minimum value along that axis is smaller.
         // Could also implement using center of interval.
-        auto comparator = (axis == 0) ? box_x_compare 
+        auto comparator = (axis == 0) ? box_x_compare
                         : (axis == 1) ? box_y_compare
                                       : box_z_compare;
 
@@ -37,42 +310,67 @@ class BVH_Node : public hittable {
         }
         else if (object_span == 2)
         {
-            left = objects[start];
-            right = objects[start+1];
+            //keep the lower object on the left so traversal order by ray direction holds
+            bool swapped = comparator(objects[start+1], objects[start]);
+            left = objects[swapped ? start+1 : start];
+            right = objects[swapped ? start : start+1];
         }//could expand to check more near base-cases
         else
         {
-            std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
-
+            //only the median has to land in place, not the whole range sorted
             auto mid = start + object_span/2;
-            left = make_shared<BVH_Node>(objects, start, mid);
-            right = make_shared<BVH_Node>(objects, mid, end);
-        }
+            std::nth_element(std::begin(objects) + start, std::begin(objects) + mid, std::begin(objects) + end, comparator);
 
+            build_children(objects, start, mid, end, options);
+        }
     }
 
-    bool hit(const Ray& r, interval ray_t, hit_record& rec) const override {
+    //binned SAH builder: split where the expected traversal cost is lowest,
+    //or keep the objects together in a leaf when that is cheaper.
+    void build_sah(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, const bvh_build_options& options) {
+        size_t object_span = end - start;
 
-        //check if hits this bounding box
-        if (!bbox.hit(r, ray_t))
-        {
-            return false;
+        if (object_span == 1) {
+            leaf_objects.push_back(objects[start]);
+            return;
         }
 
-        bool hit_left = left->hit(r, ray_t, rec);
-        //only check times sooner than when we hit left, if we did.
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+        std::vector<Bounding_Box> boxes(object_span);
+        size_t chunk_count = bvh_chunk_count(object_span);
+        bvh_for_each_chunk(chunk_count, [&](size_t chunk) {
+            for (size_t i = object_span * chunk / chunk_count; i < object_span * (chunk + 1) / chunk_count; i++)
+                boxes[i] = objects[start + i]->bounding_box();
+        });
 
-        return (hit_left || hit_right);
+        auto split = find_sah_split(object_span, [&](size_t i) { return boxes[i]; }, bbox, options);
 
-    }
+        //a leaf costs one intersection per object
+        bool small_enough = object_span <= size_t(std::max(1, options.max_leaf_size));
+        if (small_enough && (split.axis < 0 || split.cost >= double(object_span))) {
+            leaf_objects.assign(objects.begin() + start, objects.begin() + end);
+            return;
+        }
 
-    Bounding_Box bounding_box() const override {return bbox;}
+        size_t mid;
+        if (split.axis < 0) {
+            //centroids coincide, fall back to an even split of the range
+            mid = start + object_span/2;
+            axis = bbox.longest_axis();
+        }
+        else {
+            axis = split.axis;
+            auto middle = std::partition(objects.begin() + start, objects.begin() + end,
+                [&](const shared_ptr<hittable>& object) { return split.goes_left(object->bounding_box().centroid()); });
+            mid = size_t(middle - objects.begin());
+        }
 
-    private:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
-    Bounding_Box bbox;
+        build_children(objects, start, mid, end, options);
+    }
+
+    static double child_sah_cost(const shared_ptr<hittable>& child, double traversal_cost) {
+        auto node = dynamic_cast<const BVH_Node*>(child.get());
+        return node ? node->sah_cost(traversal_cost) : 1.0;
+    }
 
     //returns false if a is bigger than b for chosen axis.
     // ''     true if b is bigger than a for chosen axis.
@@ -80,7 +378,7 @@ class BVH_Node : public hittable {
     {
         auto a_axis_interval = a->bounding_box().axis_interval(axis_index);
         auto b_axis_interval = b->bounding_box().axis_interval(axis_index);
-        
+
         return (a_axis_interval.min < b_axis_interval.min);
     }
 
@@ -96,4 +394,4 @@ class BVH_Node : public hittable {
         return box_compare(a, b, 2);
     }
 
-};
\ No newline at end of file
+};
@@ -4,6 +4,16 @@
 #include "material.h"
 #include <omp.h> 
 #include "cube_map.h"
+#include "tile_scheduler.h"
+#include "render_stats.h"
+#include "pixel_estimate.h"
+#include "path_queue.h"
+#include "image_writer.h"
+#include "checkpoint.h"
+#include "sampler.h"
+
+#include <string>
+#include <typeinfo>
 
 class Camera{
     public:
@@ -21,52 +31,145 @@ class Camera{
 
     double defocus_angle = 0; //Variation angle of rays from camera center for a single pixel
     double focus_dist = 10; //Distance from the camera position to the focus plane
-    
+
+    bool packet_tracing = false; //trace primary rays of packet_width x packet_width pixel blocks together
+    int packet_width = 2; //1 to 4
+
+    int tile_size = 16; //pixels per side of the tiles threads render and steal
+
+    bool telemetry_json = false; //report progress as JSON lines on stderr instead of a status line
+    double telemetry_interval = 0.5; //seconds between progress reports
+
+    //Progressive mode renders in passes of 1, 2, 4, ... samples per pixel, accumulating into one buffer
+    //and writing a preview image after each pass. It stops at samples_per_pixel or when time_budget runs out.
+    bool progressive = false;
+    double time_budget = 0; //seconds, 0 for no limit
+    std::string preview_path = "preview.ppm";
+
+    //If set, the image goes to this file instead of a text PPM on stdout: .png, binary PPM for other
+    //extensions, or linear HDR floats for .pfm and .raw. Float images are streamed a tile at a time,
+    //as each tile finishes when rendering in a single pass.
+    std::string output_path = "";
+
+    //Next-event estimation: every bounce off a material that is not purely a mirror or glass also sends a shadow
+    //ray toward a random point of a random light (the emitting quads and spheres of the world, see
+    //hittable::collect_lights). Light reaching the bounce both ways, through the shadow ray and through the
+    //scattered ray hitting a light, is weighted by the power heuristic (multiple importance sampling), so
+    //each strategy counts most where it works best: light samples for small lights and rough surfaces,
+    //material samples for large lights and glossy ones. Small lights clean up with far fewer samples.
+    bool light_sampling = true;
+
+    bool russian_roulette = true; //end dim paths early at random, without bias
+    int roulette_min_depth = 3; //bounces every path takes before roulette starts
+
+    //Wavefront mode traces all paths of a tile a bounce at a time instead of one path to the end,
+    //see render_tile_wavefront. Larger tiles give larger waves.
+    bool wavefront = false;
+    int wavefront_queue_size = 4096; //paths in flight per thread, about 1 MB of queue
+
+    //Adaptive mode spends the same total budget (samples_per_pixel per pixel on average) where it is needed.
+    //Every pixel first takes adaptive_min_samples, then rounds of extra samples go only to pixels whose
+    //display_error is still above adaptive_threshold, up to 8 x samples_per_pixel each.
+    bool adaptive = false;
+    int adaptive_min_samples = 16;
+    double adaptive_threshold = 0.01; //standard error in display units, 1/255 is one 8 bit step
+    std::string sample_map_path = ""; //if set, a grayscale image of the samples each pixel took
+
+    //If checkpoint_path is set, the pixel estimates are saved there every checkpoint_interval seconds and at the end.
+    //With resume set, a render continues from that checkpoint (each pixel takes only the samples it still lacks),
+    //but refuses to start if the checkpoint was written for another scene or camera (see scene_fingerprint),
+    //or with another seed, sampler, first_sample or region.
+    std::string checkpoint_path = "";
+    double checkpoint_interval = 300; //seconds
+    bool resume = false;
+
+    //Every sample draws its random numbers from streams keyed by seed, its pixel, its sample number and
+    //the bounce (see random.h), so the image depends only on the seed, whatever the threads or render mode.
+    //A render can be split over processes or machines by region (only the pixels of region are rendered,
+    //an empty region is the whole image) or by samples (first_sample numbers this run's first sample of
+    //every pixel). Each part saves its estimates as a checkpoint, and tools/merge.cpp adds them up
+    //to exactly the image of a single run.
+    uint64_t seed = 0;
+    shared_ptr<sampler> pixel_sampler = make_shared<independent_sampler>(); //places those numbers, see sampler.h
+    render_tile region = { 0, 0, 0, 0 };
+    int first_sample = 0;
 
     void render(const hittable& world){
         initialize();
+        if (area.pixel_count() == 0) {
+            std::cerr << "ERROR: The render region lies outside the image.\n";
+            return;
+        }
+        find_lights(world);
+
+        //running estimate of every pixel
+        std::vector<pixel_estimate> accumulation(image_width * image_height);
+        std::vector<render_tile> image_tiles = make_tiles(image_width, image_height, tile_size);
+        std::vector<render_tile> tiles = clip_tiles(image_tiles, area);
+
+        long long resumed_samples = 0;
+        if (resume && !checkpoint_path.empty()) {
+            checkpoint_status status = read_checkpoint(checkpoint_path, checkpoint_identity(world), accumulation);
+            if (status == checkpoint_status::mismatch)
+                return;
+            for (const pixel_estimate& pixel : accumulation)
+                resumed_samples += pixel.samples;
+            if (status == checkpoint_status::loaded && !telemetry_json)
+                std::clog << "Resuming from " << checkpoint_path << " at " << double(resumed_samples) / accumulation.size() << " samples per pixel\n";
+        }
 
-        std::vector<color> frame_buffer(image_width * image_height);
-
-        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-        int pixels_completed = 0;
-
-        //maps each pixel to a ray with origin at that pixel and with a direction
-        //given by the unit vector from focal_length behind
-        #pragma omp parallel for collapse(2) schedule(dynamic, 1)
-        for (int j = 0; j < image_height; j++) {
+        //scene and BVH construction are timed by their builders, this covers only the render
+        Render_Stats stats(omp_get_max_threads(), (long long)area.pixel_count() * samples_per_pixel - resumed_samples, telemetry_json, telemetry_interval);
+        stats.start();
 
-            for (int i = 0; i < image_width; i++) {
-                color pixel_color(0,0,0);
-                //for each pixel/point, render as an average of randomly chosen nearby points.
-                for (int sample = 0; sample < samples_per_pixel; sample++) {
-                    Ray r = get_ray(i, j);
-                        pixel_color += ray_color(r, max_depth, world);
-                    }   
-                frame_buffer[j * image_width + i] = pixel_samples_scale * pixel_color;
-
-                #pragma omp critical
-                {
-                    pixels_completed++;
-                    if (pixels_completed % image_width == 0) {
-                        int scanlines_remaining = image_height - (pixels_completed / image_width);
-                        std::clog << "\rScanlines remaining: " << scanlines_remaining << ' ' << std::flush;
-                    }
-                }
-            }
+        std::unique_ptr<Checkpoint_Writer> checkpoints;
+        if (!checkpoint_path.empty()) {
+            checkpoints = std::make_unique<Checkpoint_Writer>(checkpoint_path, checkpoint_identity(world), tile_size,
+                                                              accumulation, checkpoint_interval);
+            checkpoints->start();
+            checkpoint_writer = checkpoints.get();
         }
 
+        std::unique_ptr<Float_Image_Stream> hdr_output;
+        if (is_float_format(output_path))
+            hdr_output = std::make_unique<Float_Image_Stream>(output_path, image_width, image_height);
+
+        if (adaptive)
+            render_adaptive(world, tiles, accumulation, stats);
+        else if (progressive)
+            render_progressive(world, tiles, accumulation, stats);
+        else
+            render_pass(world, tiles, accumulation, samples_missing(accumulation, samples_per_pixel), stats, hdr_output.get());
+        stats.stop();
+
+        if (checkpoints) {
+            checkpoints->stop();
+            checkpoint_writer = nullptr;
+            checkpoints->write();
+        }
 
-        for (int j = 0; j < image_height; j++)
-        {
-            for (int i = 0; i < image_width; i++)
-            {
-                write_color(std::cout, frame_buffer[j * image_width + i]);
+        if (hdr_output) {
+            //multi-pass tiles are only final now, and resumed tiles or tiles outside the region may not have been rendered at all
+            if (adaptive || progressive || resumed_samples > 0 || area.pixel_count() < image_width * image_height) {
+                for (const render_tile& tile : image_tiles)
+                    hdr_output->write_tile(tile, tile_image(tile, accumulation).data());
             }
+            hdr_output->close();
+        }
+        else if (output_path.empty())
+            write_ppm_text(std::cout, image_width, image_height, quantize(image_buffer(accumulation)));
+        else
+            write_image_file(output_path, image_width, image_height, image_buffer(accumulation));
+        if (!sample_map_path.empty())
+            write_image_file(sample_map_path, image_width, image_height, sample_map(accumulation));
+
+        //in JSON mode the final "done" record carries the time, keeping stderr machine-readable
+        if (!telemetry_json) {
+            long long samples = 0;
+            for (const pixel_estimate& pixel : accumulation)
+                samples += pixel.samples;
+            std::clog << "Render time: " << stats.elapsed() << " s, " << double(samples) / area.pixel_count() << " samples per pixel\n";
         }
-
-        std::clog << "\rDone.                 \n";
     }
 
     void set_cubemap(const char* image_filename)
@@ -78,7 +181,6 @@ class Camera{
 
     private:
     int image_height;       //Rendered image height
-    double pixel_samples_scale;  // Color scale factor for a sum of pixel samples
     
     point3 pixel00_loc;     //Location of pixel 0, 0
     Vec3 pixel_delta_u;     //Offset to pixel to the right
@@ -87,14 +189,23 @@ class Camera{
     Vec3 defocus_disk_u;    //Defocus disk horizontal radius
     Vec3 defocus_disk_v;    //Defocus disk vertical radius
 
+    //rays traced by this thread in the current tile, handed to the render stats once per tile
+    static inline thread_local long long rays_traced = 0;
+
+    //bounce_stream number for volumes hit by packets, below the numbers of the paths' own bounces
+    static constexpr int packet_traversal = -1;
+
+    Checkpoint_Writer* checkpoint_writer = nullptr; //while a render is checkpointing
+    std::vector<const hittable*> lights;        //sampled by light_sampling, in the order the world holds them
+    std::vector<const hittable*> sorted_lights; //the same, sorted to look up the objects paths hit
+    render_tile area;       //pixels this render covers: region clipped to the image, or the whole image
+
     void initialize()
     {
         image_height = int (image_width / aspect_ratio);
         //ensure height > 1.
         image_height = (image_height < 1) ? 1 : image_height;
 
-        pixel_samples_scale = 1.0 / samples_per_pixel;
-
         //relative basis for camera 
         // <x, y, z> : <u, v, w>
         w = unit_vector(position - direction);
@@ -124,6 +235,516 @@ class Camera{
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
 
+        //the region clipped to the image, or the whole image if no region is set
+        area = { 0, 0, image_width, image_height };
+        if (region.width() > 0 && region.height() > 0) {
+            area.x0 = std::clamp(region.x0, 0, image_width);
+            area.y0 = std::clamp(region.y0, 0, image_height);
+            area.x1 = std::clamp(region.x1, area.x0, image_width);
+            area.y1 = std::clamp(region.y1, area.y0, image_height);
+        }
+
+    }
+
+    //the lights of world, each once (a shape can sit in more than one BVH leaf)
+    void find_lights(const hittable& world) {
+        std::vector<const hittable*> found;
+        if (light_sampling)
+            world.collect_lights(found);
+
+        sorted_lights = found;
+        std::sort(sorted_lights.begin(), sorted_lights.end());
+        sorted_lights.erase(std::unique(sorted_lights.begin(), sorted_lights.end()), sorted_lights.end());
+
+        std::vector<bool> kept(sorted_lights.size(), false);
+        lights.clear();
+        for (const hittable* light : found) {
+            size_t k = std::lower_bound(sorted_lights.begin(), sorted_lights.end(), light) - sorted_lights.begin();
+            if (!kept[k])
+                lights.push_back(light);
+            kept[k] = true;
+        }
+        if (!telemetry_json && !lights.empty())
+            std::clog << "Sampling " << lights.size() << (lights.size() == 1 ? " light\n" : " lights\n");
+    }
+
+    bool is_sampled_light(const hittable* object) const {
+        return std::binary_search(sorted_lights.begin(), sorted_lights.end(), object);
+    }
+
+    //Renders passes of 1, 2, 4, ... samples per pixel, writing a preview after each,
+    //until samples_per_pixel is reached or the time budget runs out.
+    //A resumed render first brings every pixel up to the best-sampled one.
+    void render_progressive(const hittable& world, const std::vector<render_tile>& tiles,
+                            std::vector<pixel_estimate>& accumulation, Render_Stats& stats) {
+        int samples_done = 0;
+        for (const pixel_estimate& pixel : accumulation)
+            samples_done = std::min(samples_per_pixel, std::max(samples_done, pixel.samples));
+        if (samples_done > 0)
+            render_pass(world, tiles, accumulation, samples_missing(accumulation, samples_done), stats);
+
+        int samples_this_run = 0;
+        for (int pass_samples = 1; samples_done < samples_per_pixel; pass_samples *= 2) {
+            int pass = std::min(pass_samples, samples_per_pixel - samples_done);
+
+            //shrink the pass to what the remaining budget affords at the speed seen so far
+            if (time_budget > 0 && samples_this_run > 0) {
+                double seconds_per_sample = stats.elapsed() / samples_this_run;
+                int affordable = int((time_budget - stats.elapsed()) / seconds_per_sample);
+                if (affordable < 1)
+                    break;
+                pass = std::min(pass, affordable);
+            }
+
+            render_pass(world, tiles, accumulation, samples_missing(accumulation, samples_done + pass), stats);
+            samples_done += pass;
+            samples_this_run += pass;
+            write_preview(accumulation, std::to_string(samples_done) + " samples per pixel");
+        }
+    }
+
+    //samples each pixel of the render area lacks to reach target
+    std::vector<int> samples_missing(const std::vector<pixel_estimate>& accumulation, int target) const {
+        std::vector<int> missing(accumulation.size(), 0);
+        for (int j = area.y0; j < area.y1; j++)
+            for (int i = area.x0; i < area.x1; i++)
+                missing[j * image_width + i] = std::max(0, target - accumulation[j * image_width + i].samples);
+        return missing;
+    }
+
+    //Takes adaptive_min_samples everywhere, then hands the rest of the budget out in rounds to the pixels
+    //that have not converged. The spread that minimizes the summed squared error gives each pixel samples
+    //in proportion to its standard deviation, so each round moves the open pixels toward that share,
+    //with each pixel at most doubling per round (its estimate is still rough) and never past what
+    //it needs to reach the threshold. Tiles without open pixels are left out of a round.
+    //Writes a preview after each round if progressive.
+    void render_adaptive(const hittable& world, const std::vector<render_tile>& tiles,
+                         std::vector<pixel_estimate>& accumulation, Render_Stats& stats) {
+        long long budget = (long long)area.pixel_count() * samples_per_pixel;
+        for (const pixel_estimate& pixel : accumulation)
+            budget -= pixel.samples; //taken before a resume
+        int max_samples = 8 * samples_per_pixel;
+        //a minimum above samples_per_pixel would overspend the budget in the first round
+        std::vector<int> request = samples_missing(accumulation, std::max(1, std::min(adaptive_min_samples, samples_per_pixel)));
+        std::vector<double> error(accumulation.size());
+
+        for (int round = 1; ; round++) {
+            std::vector<render_tile> active_tiles;
+            long long requested = 0;
+            for (const render_tile& tile : tiles) {
+                long long tile_samples = 0;
+                for (int j = tile.y0; j < tile.y1; j++)
+                    for (int i = tile.x0; i < tile.x1; i++)
+                        tile_samples += request[j * image_width + i];
+                if (tile_samples > 0)
+                    active_tiles.push_back(tile);
+                requested += tile_samples;
+            }
+            //a resumed render may already be past the first round
+            if (requested == 0 && round > 1)
+                break;
+
+            render_pass(world, active_tiles, accumulation, request, stats);
+            budget -= requested;
+
+            //open pixels, their summed standard deviation and the samples they already hold
+            int unconverged = 0;
+            double deviation_sum = 0;
+            long long open_samples = 0;
+            for (int j = area.y0; j < area.y1; j++) {
+                for (int i = area.x0; i < area.x1; i++) {
+                    int p = j * image_width + i;
+                    const pixel_estimate& pixel = accumulation[p];
+                    error[p] = pixel.display_error(window_estimate(accumulation, i, j));
+                    if (pixel.samples >= max_samples || error[p] <= adaptive_threshold) {
+                        error[p] = 0;
+                        continue;
+                    }
+                    unconverged++;
+                    deviation_sum += error[p] * std::sqrt(double(pixel.samples));
+                    open_samples += pixel.samples;
+                }
+            }
+            if (progressive)
+                write_preview(accumulation, "round " + std::to_string(round) + ", " + std::to_string(unconverged) + " pixels unconverged");
+
+            if (unconverged == 0 || budget <= 0 || (time_budget > 0 && stats.elapsed() >= time_budget))
+                break;
+
+            double extra_sum = 0;
+            std::vector<double> extra(accumulation.size(), 0);
+            for (size_t p = 0; p < accumulation.size(); p++) {
+                if (error[p] == 0)
+                    continue;
+                double n = accumulation[p].samples;
+                double share = (open_samples + budget) * error[p] * std::sqrt(n) / deviation_sum;
+                double needed = n * (error[p] / adaptive_threshold) * (error[p] / adaptive_threshold);
+                extra[p] = std::clamp(std::min({ share, needed, double(max_samples) }) - n, 0.0, n);
+                extra_sum += extra[p];
+            }
+
+            //shares the clamping pushed up are paid for by scaling the round down to the budget
+            double scale = std::min(1.0, budget / std::max(extra_sum, 1.0));
+            for (size_t p = 0; p < accumulation.size(); p++)
+                request[p] = int(std::lround(extra[p] * scale));
+        }
+    }
+
+    //Hash of everything the samples in a checkpoint depend on: the camera and the bounds of the world.
+    //Scenes cannot be serialized, so an edit that leaves the world's bounds unchanged is not caught.
+    //Region, sample range and seed are left out, so the parts of a split render share one fingerprint.
+    uint64_t scene_fingerprint(const hittable& world) const {
+        uint64_t hash = 14695981039346656037ull;
+        for (double value : { aspect_ratio, double(image_width), double(max_depth), double(vfov),
+                              position.x, position.y, position.z, direction.x, direction.y, direction.z, up.x, up.y, up.z,
+                              defocus_angle, focus_dist, background.x, background.y, background.z, double(has_cubemap) })
+            hash = hash_value(hash, value);
+
+        Bounding_Box box = world.bounding_box();
+        for (int axis = 0; axis < 3; axis++) {
+            hash = hash_value(hash, box.axis_interval(axis).min);
+            hash = hash_value(hash, box.axis_interval(axis).max);
+        }
+        return hash;
+    }
+
+    //Header of this render's checkpoints: the scene fingerprint, and the seed, sampler, sample numbers and
+    //region that tell the parts of a split render apart, so tools/merge.cpp can refuse parts that do not fit.
+    checkpoint_header checkpoint_identity(const hittable& world) const {
+        checkpoint_header header;
+        header.width = image_width;
+        header.height = image_height;
+        header.fingerprint = scene_fingerprint(world);
+        header.seed = seed;
+        header.set_sampler(pixel_sampler->name());
+        header.first_sample = first_sample;
+        header.last_sample = first_sample + (adaptive ? 8 * samples_per_pixel : samples_per_pixel);
+        header.x0 = area.x0;
+        header.y0 = area.y0;
+        header.x1 = area.x1;
+        header.y1 = area.y1;
+        return header;
+    }
+
+    //samples of the 3x3 pixels around i, j pooled into one estimate
+    pixel_estimate window_estimate(const std::vector<pixel_estimate>& accumulation, int i, int j) const {
+        pixel_estimate window;
+        for (int y = std::max(0, j - 1); y <= std::min(image_height - 1, j + 1); y++)
+            for (int x = std::max(0, i - 1); x <= std::min(image_width - 1, i + 1); x++)
+                window.merge(accumulation[y * image_width + x]);
+        return window;
+    }
+
+    //Adds samples[pixel] samples to each pixel of the given tiles.
+    //Tiles along a Morton curve, work stealing between threads. Each tile is rendered into
+    //a local buffer and added in once, so threads never write next to each other's pixels.
+    //If the pass is the last, finished tiles can go straight to a float image stream.
+    void render_pass(const hittable& world, const std::vector<render_tile>& tiles, std::vector<pixel_estimate>& accumulation,
+                     const std::vector<int>& samples, Render_Stats& stats, Float_Image_Stream* finished = nullptr) {
+        Tile_Scheduler scheduler(tiles);
+        scheduler.run([&](const render_tile& tile, int thread) {
+            double tile_start = omp_get_wtime();
+            rays_traced = 0;
+            std::vector<pixel_estimate> tile_buffer(tile.pixel_count());
+
+            if (wavefront)
+                render_tile_wavefront(tile, world, tile_buffer, accumulation, samples);
+            else if (packet_tracing)
+                render_tile_packets(tile, world, tile_buffer, accumulation, samples);
+            else
+                render_tile_pixels(tile, world, tile_buffer, accumulation, samples);
+
+            long long tile_samples = 0;
+            {
+                std::unique_lock<std::mutex> guard;
+                if (checkpoint_writer)
+                    guard = std::unique_lock<std::mutex>(checkpoint_writer->band_lock(tile.y0));
+                for (int j = tile.y0; j < tile.y1; j++) {
+                    for (int i = tile.x0; i < tile.x1; i++) {
+                        const pixel_estimate& pixel = tile_buffer[(j - tile.y0) * tile.width() + (i - tile.x0)];
+                        accumulation[j * image_width + i].merge(pixel);
+                        tile_samples += pixel.samples;
+                    }
+                }
+            }
+
+            if (finished)
+                finished->write_tile(tile, tile_image(tile, accumulation).data());
+
+            stats.record_tile(thread, tile_samples, rays_traced, omp_get_wtime() - tile_start);
+        });
+    }
+
+    void write_preview(const std::vector<pixel_estimate>& accumulation, const std::string& progress) const {
+        write_image_file(preview_path, image_width, image_height, image_buffer(accumulation));
+        if (!telemetry_json)
+            std::clog << "\nPreview written to " << preview_path << ": " << progress << "\n";
+    }
+
+    //mean of each pixel of the tile as linear float RGB, rows top to bottom
+    std::vector<float> tile_image(const render_tile& tile, const std::vector<pixel_estimate>& accumulation) const {
+        std::vector<float> rgb;
+        rgb.reserve(size_t(tile.pixel_count()) * 3);
+        for (int j = tile.y0; j < tile.y1; j++) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                color mean = accumulation[j * image_width + i].mean();
+                rgb.insert(rgb.end(), { float(mean.r), float(mean.g), float(mean.b) });
+            }
+        }
+        return rgb;
+    }
+
+    //mean of each pixel as linear float RGB, for the image writers
+    std::vector<float> image_buffer(const std::vector<pixel_estimate>& accumulation) const {
+        std::vector<float> rgb(accumulation.size() * 3);
+        long long count = (long long)accumulation.size();
+
+        #pragma omp parallel for schedule(static)
+        for (long long p = 0; p < count; p++) {
+            color mean = accumulation[p].mean();
+            rgb[3 * p] = float(mean.r);
+            rgb[3 * p + 1] = float(mean.g);
+            rgb[3 * p + 2] = float(mean.b);
+        }
+        return rgb;
+    }
+
+    //each pixel's sample count relative to the largest, as a gray image (squared, so it shows linearly after gamma)
+    std::vector<float> sample_map(const std::vector<pixel_estimate>& accumulation) const {
+        int most = 1;
+        for (const pixel_estimate& pixel : accumulation)
+            most = std::max(most, pixel.samples);
+
+        std::vector<float> rgb;
+        rgb.reserve(accumulation.size() * 3);
+        for (const pixel_estimate& pixel : accumulation) {
+            float level = float(pixel.samples) / most;
+            rgb.insert(rgb.end(), 3, level * level);
+        }
+        return rgb;
+    }
+
+    //maps each pixel to a ray with origin at that pixel and with a direction
+    //given by the unit vector from focal_length behind
+    //takes samples[pixel] samples for each pixel of the tile into tile_buffer,
+    //numbered on from the samples the pixel already holds in accumulation
+    void render_tile_pixels(const render_tile& tile, const hittable& world, std::vector<pixel_estimate>& tile_buffer,
+                            const std::vector<pixel_estimate>& accumulation, const std::vector<int>& samples) {
+        for (int j = tile.y0; j < tile.y1; j++) {
+
+            for (int i = tile.x0; i < tile.x1; i++) {
+                pixel_estimate& pixel = tile_buffer[(j - tile.y0) * tile.width() + (i - tile.x0)];
+                int p = j * image_width + i;
+                //for each pixel/point, render as an average of randomly chosen nearby points.
+                for (int sample = 0; sample < samples[p]; sample++) {
+                    sample_id id = make_sample(i, j, first_sample + accumulation[p].samples + sample);
+                    random_engine() = bounce_stream(id, 0);
+                    Ray r = get_ray(i, j);
+                        pixel.add(ray_color(r, max_depth, world, id));
+                    }   
+            }
+        }
+    }
+
+    //Same image as render_tile_pixels, but each sample of a block of pixels starts as one ray packet,
+    //so the primary rays share BVH traversal. Bounces are traced one ray at a time.
+    //Pixels of the block that already took all their samples drop out of the later packets.
+    //Volumes hit by a packet draw from a stream of the packet's first path, so the image is still
+    //reproducible, but differs from render_tile_pixels in scenes with volumes.
+    void render_tile_packets(const render_tile& tile, const hittable& world, std::vector<pixel_estimate>& tile_buffer,
+                             const std::vector<pixel_estimate>& accumulation, const std::vector<int>& samples) {
+        int block = std::max(1, std::min(packet_width, 4));
+
+        for (int block_y = tile.y0; block_y < tile.y1; block_y += block) {
+
+            for (int block_x = tile.x0; block_x < tile.x1; block_x += block) {
+                //pixels of the block inside the tile, one packet lane each
+                int lane_i[ray_packet::max_size], lane_j[ray_packet::max_size];
+                int lane_samples[ray_packet::max_size], lane_first[ray_packet::max_size];
+                int lanes = 0, most_samples = 0;
+                for (int j = block_y; j < std::min(block_y + block, tile.y1); j++) {
+                    for (int i = block_x; i < std::min(block_x + block, tile.x1); i++) {
+                        lane_i[lanes] = i;
+                        lane_j[lanes] = j;
+                        lane_samples[lanes] = samples[j * image_width + i];
+                        lane_first[lanes] = first_sample + accumulation[j * image_width + i].samples;
+                        most_samples = std::max(most_samples, lane_samples[lanes]);
+                        lanes++;
+                    }
+                }
+
+                for (int sample = 0; sample < most_samples; sample++) {
+                    ray_packet packet;
+                    int packet_pixel[ray_packet::max_size]; //block lane of each packet lane
+                    sample_id ids[ray_packet::max_size];
+                    for (int lane = 0; lane < lanes; lane++) {
+                        if (sample < lane_samples[lane]) {
+                            sample_id id = make_sample(lane_i[lane], lane_j[lane], lane_first[lane] + sample);
+                            random_engine() = bounce_stream(id, 0);
+                            ids[packet.size] = id;
+                            packet_pixel[packet.add(get_ray(lane_i[lane], lane_j[lane]), interval(0.001, infinity))] = lane;
+                        }
+                    }
+
+                    random_engine() = bounce_stream(ids[0], packet_traversal);
+                    hit_record recs[ray_packet::max_size];
+                    uint32_t hits = world.hit_packet(packet, packet.all(), recs);
+                    rays_traced += packet.size;
+
+                    for (int lane = 0; lane < packet.size; lane++) {
+                        int pixel = packet_pixel[lane];
+                        tile_buffer[(lane_j[pixel] - tile.y0) * tile.width() + (lane_i[pixel] - tile.x0)]
+                            .add(shade(packet.rays[lane], (hits >> lane) & 1, recs[lane], max_depth, world, ids[lane]));
+                    }
+                }
+            }
+        }
+    }
+
+    //Same image as render_tile_pixels, traced breadth first in four stages over a queue of paths:
+    //generate tops the queue up with camera rays, extend traces every path's next segment, shade
+    //evaluates the hits grouped by material type so each material's code and data stay in cache,
+    //and connect hands finished paths to their pixels and compacts the survivors.
+    //Each path keeps its random stream in the queue between stages, so without packet_tracing the image
+    //is exactly that of render_tile_pixels.
+    void render_tile_wavefront(const render_tile& tile, const hittable& world, std::vector<pixel_estimate>& tile_buffer,
+                               const std::vector<pixel_estimate>& accumulation, const std::vector<int>& samples) {
+        path_queue queue;
+        std::vector<const std::type_info*> kinds; //material types met so far, nullptr for misses
+        std::vector<int> kind, order;
+        int capacity = std::max(1, wavefront_queue_size);
+        int next_pixel = 0, next_sample = 0;
+
+        while (true) {
+            //generate
+            while (queue.size() < capacity && next_pixel < tile.pixel_count()) {
+                int i = tile.x0 + next_pixel % tile.width();
+                int j = tile.y0 + next_pixel / tile.width();
+                int p = j * image_width + i;
+                if (next_sample < samples[p]) {
+                    if (max_depth > 0) {
+                        sample_id id = make_sample(i, j, first_sample + accumulation[p].samples + next_sample);
+                        random_engine() = bounce_stream(id, 0);
+                        Ray r = get_ray(i, j);
+                        queue.push(r, next_pixel, max_depth, id, random_engine());
+                    }
+                    else
+                        tile_buffer[next_pixel].add(color(0, 0, 0));
+                    next_sample++;
+                }
+                else {
+                    next_pixel++;
+                    next_sample = 0;
+                }
+            }
+            if (queue.size() == 0)
+                break;
+
+            extend(queue, world);
+
+            //shade, grouped by material type with a counting sort, so paths on the same kind of material run back to back
+            kind.resize(queue.size());
+            for (int path = 0; path < queue.size(); path++) {
+                const std::type_info* type = queue.hit[path] ? &typeid(*queue.recs[path].mat) : nullptr;
+                kind[path] = int(std::find(kinds.begin(), kinds.end(), type) - kinds.begin());
+                if (kind[path] == int(kinds.size()))
+                    kinds.push_back(type);
+            }
+            std::vector<int> start(kinds.size() + 1, 0);
+            for (int k : kind)
+                start[k + 1]++;
+            for (size_t k = 1; k < start.size(); k++)
+                start[k] += start[k - 1];
+            order.resize(queue.size());
+            for (int path = 0; path < queue.size(); path++)
+                order[start[kind[path]]++] = path;
+            for (int path : order)
+                shade_path(queue, path, world);
+
+            //connect
+            int survivors = 0;
+            for (int path = 0; path < queue.size(); path++) {
+                if (queue.depth[path] == 0)
+                    tile_buffer[queue.pixel[path]].add(queue.radiance[path]);
+                else
+                    queue.move(path, survivors++);
+            }
+            queue.resize(survivors);
+        }
+    }
+
+    //traces the current ray of every path in the queue, in packets when packet_tracing is set
+    void extend(path_queue& queue, const hittable& world) {
+        rays_traced += queue.size();
+        if (!packet_tracing) {
+            for (int path = 0; path < queue.size(); path++) {
+                random_engine() = queue.rng[path];
+                queue.hit[path] = world.hit(queue.rays[path], interval(0.001, infinity), queue.recs[path]);
+            }
+            return;
+        }
+
+        for (int first = 0; first < queue.size(); first += ray_packet::max_size) {
+            ray_packet packet;
+            int count = std::min(ray_packet::max_size, queue.size() - first);
+            for (int lane = 0; lane < count; lane++)
+                packet.add(queue.rays[first + lane], interval(0.001, infinity));
+            random_engine() = bounce_stream(queue.sample[first], packet_traversal - queue.bounce[first]);
+
+            uint32_t hits = world.hit_packet(packet, packet.all(), &queue.recs[first]);
+            for (int lane = 0; lane < count; lane++)
+                queue.hit[first + lane] = (hits >> lane) & 1;
+        }
+    }
+
+    //one iteration of the loop in shade, for one path of the queue; sets depth to 0 when the path ends
+    void shade_path(path_queue& queue, int path, const hittable& world) {
+        const Ray& r = queue.rays[path];
+        const hit_record& rec = queue.recs[path];
+        color& throughput = queue.throughput[path];
+        random_engine() = bounce_stream(queue.sample[path], queue.bounce[path] + 1);
+
+        if (!queue.hit[path]) {
+            queue.radiance[path] += throughput * (has_cubemap ? cubemap.value(r.direction) : background);
+            queue.depth[path] = 0;
+            return;
+        }
+
+        queue.radiance[path] += throughput * hit_emission(r, rec, queue.scatter_pdf[path]);
+
+        scatter_sample scattered;
+        bool scatters = rec.mat->sample(r, rec, scattered);
+        if (--queue.depth[path] <= 0) {
+            queue.depth[path] = 0;
+            return;
+        }
+        bool sample_lights = !lights.empty() && !rec.mat->is_delta();
+        if (sample_lights)
+            queue.radiance[path] += throughput * direct_light(r, rec, world);
+        if (!scatters) {
+            queue.depth[path] = 0;
+            return;
+        }
+        queue.scatter_pdf[path] = sample_lights && !scattered.delta ? scattered.pdf : 0;
+        throughput = throughput * scattered.weight;
+
+        if (russian_roulette && queue.bounce[path] >= roulette_min_depth) {
+            double survival = std::min(0.95, std::max({ throughput.x, throughput.y, throughput.z }));
+            if (random_double() >= survival) {
+                queue.depth[path] = 0;
+                return;
+            }
+            throughput /= survival;
+        }
+
+        queue.bounce[path]++;
+        queue.rays[path] = Ray(rec.collision, scattered.direction, r.time);
+        queue.rng[path] = random_engine(); //the next extend continues this stream
+    }
+
+    sample_id make_sample(int i, int j, long long index) const {
+        uint64_t pixel = uint64_t(j) * image_width + i;
+        return sample_id{ sample_key(seed, pixel, index), seed, pixel_key(seed, pixel), i, j, uint32_t(index), pixel_sampler.get() };
     }
 
     // Construct a camera ray originating from the defocus disk at the origin
@@ -151,7 +772,7 @@ class Camera{
         return Vec3(random_double() - 0.5, random_double() - 0.5, 0);
     }
 
-    color ray_color(const Ray& r, int depth, const hittable& world){
+    color ray_color(const Ray& r, int depth, const hittable& world, const sample_id& sample){
         //if exceeded bounce limit, gather no light.
         if (depth <= 0)
         {
@@ -159,28 +780,105 @@ class Camera{
         }
 
         hit_record rec;
+        rays_traced++;
+        bool hit = world.hit(r, interval(0.001, infinity), rec);
+        return shade(r, hit, rec, depth, world, sample);
+    }
 
-        //if we hit nothing, return the background or enviroment (cube map)
-        if (!(world.hit(r, interval(0.001, infinity), rec)))
-        {
-            if (!has_cubemap) {
-                return background;
-            }
-            return cubemap.value(r.direction);
-        }
+    //Power heuristic weight of a sample taken with density pdf, against another strategy with other_pdf
+    static double power_heuristic(double pdf, double other_pdf) {
+        return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+    }
 
-        //if we did hit something...
-        color attenuation;
-        Ray scattered;
+    //Light emitted by what r hit. If the bounce that cast r also sampled the lights (scatter_pdf, the density
+    //of r's direction, is above 0) and r found one of them, that light is shared with the light sample.
+    color hit_emission(const Ray& r, const hit_record& rec, double scatter_pdf) const {
         color emission = rec.mat->emitted(rec.u, rec.v, rec.collision);
+        if (scatter_pdf <= 0 || !is_sampled_light(rec.object))
+            return emission;
+        double light_pdf = rec.object->pdf(r.origin, r.direction, r.time) / lights.size();
+        return emission * power_heuristic(scatter_pdf, light_pdf);
+    }
 
-        //if we scattered, follow next ray
-        if (rec.mat->scatter(r, rec, attenuation, scattered))
-        {
-            return emission + attenuation * ray_color(scattered, depth-1, world);
+    //Light reaching rec straight from one light picked at random, scattered back along r, divided by the
+    //probability of picking that light and direction, and weighted against the material's own sampling.
+    //Draws from the current stream.
+    color direct_light(const Ray& r, const hit_record& rec, const hittable& world) {
+        int count = int(lights.size());
+        const hittable* light = lights[count == 1 ? 0 : std::min(int(random_double() * count), count - 1)];
+        Vec3 direction = unit_vector(light->sample(rec.collision, r.time));
+        double pdf = light->pdf(rec.collision, direction, r.time) / count;
+        if (pdf <= 0)
+            return color(0, 0, 0);
+
+        color scattering = rec.mat->evaluate(r, rec, direction);
+        if (scattering.near_zero())
+            return color(0, 0, 0);
+
+        Ray shadow(rec.collision, direction, r.time);
+        hit_record light_rec;
+        if (!light->hit(shadow, interval(0.001, infinity), light_rec))
+            return color(0, 0, 0);
+        rays_traced++;
+        if (world.occluded(shadow, interval(0.001, light_rec.t - 0.001)))
+            return color(0, 0, 0);
+
+        double weight = power_heuristic(pdf, rec.mat->pdf(r, rec, direction));
+        return scattering * light_rec.mat->emitted(light_rec.u, light_rec.v, light_rec.collision) * (weight / pdf);
+    }
+
+    //Color seen along r, given the result of tracing it into the world.
+    //Follows the path iteratively, carrying the product of the attenuations so far (throughput).
+    //After roulette_min_depth bounces, a path survives each bounce with probability equal to its
+    //largest throughput channel (at most 0.95), and survivors are divided by that probability.
+    //Dim paths end early, while every path's expected contribution stays the same.
+    //Each bounce draws from its own stream of the sample. With light_sampling, bounces off materials that
+    //are not delta add direct_light, and the light the scattered ray then finds is weighted by hit_emission.
+    //A bounce samples the lights even if the material absorbs its scattered ray, but not at the bounce limit.
+    color shade(Ray r, bool hit, hit_record rec, int depth, const hittable& world, const sample_id& sample){
+        color radiance(0, 0, 0);
+        color throughput(1, 1, 1);
+        double scatter_pdf = 0; //of r's direction, if the bounce that cast it also sampled the lights
+
+        for (int bounce = 0; ; bounce++) {
+            //if we hit nothing, add the background or enviroment (cube map)
+            if (!hit)
+            {
+                radiance += throughput * (has_cubemap ? cubemap.value(r.direction) : background);
+                break;
+            }
+
+            //if we did hit something...
+            radiance += throughput * hit_emission(r, rec, scatter_pdf);
+            random_engine() = bounce_stream(sample, bounce + 1);
+
+            //stop at the bounce limit and at absorbing materials
+            scatter_sample scattered;
+            bool scatters = rec.mat->sample(r, rec, scattered);
+            if (--depth <= 0)
+                break;
+            bool sample_lights = !lights.empty() && !rec.mat->is_delta();
+            if (sample_lights)
+                radiance += throughput * direct_light(r, rec, world);
+            if (!scatters)
+                break;
+            scatter_pdf = sample_lights && !scattered.delta ? scattered.pdf : 0;
+            throughput = throughput * scattered.weight;
+
+            if (russian_roulette && bounce >= roulette_min_depth) {
+                double survival = std::min(0.95, std::max({ throughput.x, throughput.y, throughput.z }));
+                if (random_double() >= survival)
+                    break;
+                throughput /= survival;
+            }
+
+            //follow the scattered ray
+            r = Ray(rec.collision, scattered.direction, r.time);
+            rays_traced++;
+            hit = world.hit(r, interval(0.001, infinity), rec);
         }
-        //otherwise return just emission
-        return emission;
+
+        return radiance;
     }
     
 };
\ No newline at end of file
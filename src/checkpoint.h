@@ -0,0 +1,205 @@
+#pragma once
+
+#include "pixel_estimate.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//FNV-1a over the bytes of a value, for fingerprinting a scene and camera
+template <typename T>
+inline uint64_t hash_value(uint64_t hash, const T& value) {
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    for (unsigned char byte : bytes)
+        hash = (hash ^ byte) * 1099511628211ull;
+    return hash;
+}
+
+//Checkpoint file: "RTCK", version, width, height, scene fingerprint, the seed, sampler, sample range and region
+//of the render, then for every pixel (rows top to bottom) its fixed point color sum (3 int64), sum of squared
+//luminances (double) and sample count (int32), all little endian.
+//The same file is the partial output of a split render (see tools/merge.cpp).
+struct checkpoint_header {
+    char magic[4] = { 'R', 'T', 'C', 'K' };
+    uint32_t version = 3;
+    int32_t width = 0, height = 0;
+    uint64_t fingerprint = 0;
+    uint64_t seed = 0;
+    int32_t first_sample = 0, last_sample = 0; //sample numbers [first_sample, last_sample) the pixels may hold
+    int32_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;   //region [x0, x1) x [y0, y1) of the pixels rendered
+    char sampler[32] = {};                     //sampler::name, zero terminated
+
+    void set_sampler(const std::string& name) {
+        std::memset(sampler, 0, sizeof(sampler));
+        std::memcpy(sampler, name.data(), std::min(name.size(), sizeof(sampler) - 1));
+    }
+
+    bool overlaps(const checkpoint_header& other) const {
+        return x0 < other.x1 && other.x0 < x1 && y0 < other.y1 && other.y0 < y1;
+    }
+};
+
+constexpr size_t checkpoint_pixel_bytes = 3 * sizeof(int64_t) + sizeof(double) + sizeof(int32_t);
+
+//Writes snapshots of the pixel estimates every interval seconds from its own thread. The image is copied a band
+//of rows at a time under that band's lock, which render threads also take to merge a finished tile, so they
+//wait for at most one band copy and never for the disk. Bands are copied at different moments, but each
+//pixel carries its own sample count, so the snapshot is still a valid partial render.
+//A snapshot goes to path + ".tmp" and is renamed over path once complete, so a crash mid-write
+//leaves the previous checkpoint intact.
+class Checkpoint_Writer {
+    public:
+    Checkpoint_Writer(const std::string& path, const checkpoint_header& header, int band_height,
+                      const std::vector<pixel_estimate>& pixels, double interval)
+    : path(path), header(header), width(header.width), height(header.height), band_height(std::max(1, band_height)),
+      pixels(pixels), interval(interval), bands((height + this->band_height - 1) / this->band_height) {}
+
+    ~Checkpoint_Writer() { stop(); }
+
+    void start() {
+        running = true;
+        writer = std::thread([this] {
+            std::unique_lock<std::mutex> guard(writer_lock);
+            while (!writer_wake.wait_for(guard, std::chrono::duration<double>(interval), [this] { return !running; }))
+                write();
+        });
+    }
+
+    void stop() {
+        if (!writer.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> guard(writer_lock);
+            running = false;
+        }
+        writer_wake.notify_all();
+        writer.join();
+    }
+
+    //lock guarding the pixels of row y
+    std::mutex& band_lock(int y) { return bands[y / band_height].lock; }
+
+    //writes one snapshot now; false, after reporting on std::cerr, if it could not be written
+    bool write() {
+        std::string temporary = path + ".tmp";
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        std::vector<unsigned char> buffer;
+        for (int first_row = 0; first_row < height; first_row += band_height) {
+            int rows = std::min(band_height, height - first_row);
+            buffer.resize(size_t(rows) * width * checkpoint_pixel_bytes);
+            {
+                std::lock_guard<std::mutex> guard(band_lock(first_row));
+                unsigned char* at = buffer.data();
+                for (size_t p = size_t(first_row) * width; p < size_t(first_row + rows) * width; p++) {
+                    const pixel_estimate& pixel = pixels[p];
+                    int32_t samples = pixel.samples;
+                    std::memcpy(at, pixel.sum_fixed, sizeof(pixel.sum_fixed));
+                    std::memcpy(at + 24, &pixel.luminance_squares, sizeof(double));
+                    std::memcpy(at + 32, &samples, sizeof(samples));
+                    at += checkpoint_pixel_bytes;
+                }
+            }
+            out.write(reinterpret_cast<const char*>(buffer.data()), std::streamsize(buffer.size()));
+        }
+
+        out.close();
+        if (out.fail() || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::cerr << "ERROR: Could not write checkpoint '" << path << "'.\n";
+            return false;
+        }
+        return true;
+    }
+
+    private:
+    struct alignas(64) band {
+        std::mutex lock;
+    };
+
+    std::string path;
+    checkpoint_header header;
+    int width, height, band_height;
+    const std::vector<pixel_estimate>& pixels;
+    double interval;
+    std::vector<band> bands;
+
+    bool running = false;
+    std::thread writer;
+    std::mutex writer_lock;
+    std::condition_variable writer_wake;
+};
+
+enum class checkpoint_status {missing, mismatch, loaded};
+
+//Reads any checkpoint file into header and pixels, whatever its size and fingerprint; the caller checks those.
+//Returns missing if the file cannot be opened and mismatch, after reporting on std::cerr, if it is not a
+//checkpoint of this version or is truncated.
+inline checkpoint_status read_estimates(const std::string& path, checkpoint_header& header,
+                                        std::vector<pixel_estimate>& pixels) {
+    std::ifstream in(path, std::ios::binary);
+    checkpoint_header expected;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return checkpoint_status::missing;
+
+    if (std::memcmp(header.magic, expected.magic, 4) != 0 || header.version != expected.version ||
+        header.width <= 0 || header.height <= 0) {
+        std::cerr << "ERROR: '" << path << "' is not a checkpoint of this renderer version.\n";
+        return checkpoint_status::mismatch;
+    }
+    header.sampler[sizeof(header.sampler) - 1] = 0;
+
+    std::vector<unsigned char> buffer(size_t(header.width) * header.height * checkpoint_pixel_bytes);
+    if (!in.read(reinterpret_cast<char*>(buffer.data()), std::streamsize(buffer.size()))) {
+        std::cerr << "ERROR: Checkpoint '" << path << "' is truncated.\n";
+        return checkpoint_status::mismatch;
+    }
+
+    pixels.assign(size_t(header.width) * header.height, pixel_estimate());
+    const unsigned char* at = buffer.data();
+    for (pixel_estimate& pixel : pixels) {
+        int32_t samples;
+        std::memcpy(pixel.sum_fixed, at, sizeof(pixel.sum_fixed));
+        std::memcpy(&pixel.luminance_squares, at + 24, sizeof(double));
+        std::memcpy(&samples, at + 32, sizeof(samples));
+        pixel.samples = samples;
+        at += checkpoint_pixel_bytes;
+    }
+    return checkpoint_status::loaded;
+}
+
+//Reads a checkpoint into pixels. A checkpoint for another scene, camera or image size, or one written with
+//another seed, sampler, first sample or region, or a truncated one, is reported on std::cerr and left unread.
+inline checkpoint_status read_checkpoint(const std::string& path, const checkpoint_header& expected,
+                                         std::vector<pixel_estimate>& pixels) {
+    checkpoint_header header;
+    std::vector<pixel_estimate> read;
+    checkpoint_status status = read_estimates(path, header, read);
+    if (status != checkpoint_status::loaded)
+        return status;
+
+    if (header.width != expected.width || header.height != expected.height || header.fingerprint != expected.fingerprint) {
+        std::cerr << "ERROR: Checkpoint '" << path << "' was written for a different scene or camera.\n";
+        return checkpoint_status::mismatch;
+    }
+    //the samples it holds continue from first_sample, so more samples per pixel (a later last_sample) are fine
+    if (header.seed != expected.seed || std::strcmp(header.sampler, expected.sampler) != 0 ||
+        header.first_sample != expected.first_sample || !(header.x0 == expected.x0 && header.y0 == expected.y0 &&
+        header.x1 == expected.x1 && header.y1 == expected.y1)) {
+        std::cerr << "ERROR: Checkpoint '" << path << "' was written with a different seed, sampler, first sample or region.\n";
+        return checkpoint_status::mismatch;
+    }
+    pixels = std::move(read);
+    return checkpoint_status::loaded;
+}
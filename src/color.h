@@ -31,5 +31,5 @@ inline void write_color(std::ostream &out, const color& pixel_color) {
     int gbyte = static_cast<int>(255.999 * intensity.clamp(g));
     int bbyte = static_cast<int>(255.999 * intensity.clamp(b));
 
-    std::cout << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
+    out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
 }
\ No newline at end of file
@@ -1,8 +1,12 @@
 #pragma once
 #include "utility.h"
 #include "bounding_box.h"
+#include "ray_packet.h"
+
+#include <vector>
 
 class material;
+class hittable;
 
 class hit_record
 {
@@ -14,6 +18,7 @@ class hit_record
     bool front_face;
     double u;
     double v;
+    const hittable* object = nullptr; //primitive hit, to tell the camera when a path finds a light it samples
 
 
     void set_face_normal(const Ray& r, const Vec3& outward_normal)
@@ -32,7 +37,41 @@ class hittable
     //with check for hits over time interval [t_min, t_max], store any hits into the hit_records data array||object
     virtual bool hit(const Ray& r, interval ray_t, hit_record& rec) const = 0;
 
+    //Any-hit query: true if anything blocks the ray within ray_t. Stops at the first intersection found
+    //and builds no hit_record, so shadow and visibility rays pay much less than a closest hit.
+    virtual bool occluded(const Ray& r, interval ray_t) const {
+        hit_record rec;
+        return hit(r, ray_t, rec);
+    }
+
+    //Traces the active lanes of a packet. Every lane that hits something closer than its current interval
+    //gets its record in recs[lane] and its interval lowered. Returns the mask of those lanes.
+    //Acceleration structures override this to share traversal between lanes, by default each lane is traced alone.
+    virtual uint32_t hit_packet(ray_packet& packet, uint32_t active, hit_record* recs) const {
+        uint32_t hits = 0;
+        for (int lane = 0; lane < packet.size; lane++) {
+            if (!(active & (1u << lane)))
+                continue;
+            if (hit(packet.rays[lane], packet.ray_t[lane], recs[lane])) {
+                packet.set_closest(lane, recs[lane].t);
+                hits |= 1u << lane;
+            }
+        }
+        return hits;
+    }
+
     virtual Bounding_Box bounding_box() const = 0;
+
+    //Light sampling (next-event estimation). Shapes that can be sampled add themselves to lights if they emit,
+    //containers pass the call on to their objects. Transformed, instanced and volume objects are not collected,
+    //their light is still found by paths that hit them.
+    virtual void collect_lights(std::vector<const hittable*>& lights) const {}
+
+    //returns a direction from origin toward a random point of the shape, as seen at the given time
+    virtual Vec3 sample(const point3& origin, double time) const { return Vec3(1, 0, 0); }
+
+    //probability density, per unit solid angle, of sample returning direction: 0 where the direction misses the shape
+    virtual double pdf(const point3& origin, const Vec3& direction, double time) const { return 0; }
 };
 
 class translate : public hittable {
@@ -57,6 +96,30 @@ class translate : public hittable {
         return true;
     }
 
+    bool occluded(const Ray& r, interval ray_t) const override
+    {
+        return object->occluded(Ray(r.origin - translation, r.direction, r.time), ray_t);
+    }
+
+    uint32_t hit_packet(ray_packet& packet, uint32_t active, hit_record* recs) const override
+    {
+        ray_packet offset_packet;
+        for (int lane = 0; lane < packet.size; lane++) {
+            const Ray& r = packet.rays[lane];
+            offset_packet.add(Ray(r.origin - translation, r.direction, r.time), packet.ray_t[lane]);
+        }
+
+        uint32_t hits = object->hit_packet(offset_packet, active, recs);
+        for (int lane = 0; lane < packet.size; lane++) {
+            if (hits & (1u << lane)) {
+                recs[lane].collision += translation;
+                packet.set_closest(lane, recs[lane].t);
+            }
+        }
+
+        return hits;
+    }
+
     Bounding_Box bounding_box() const override { return bbox; }
 
     private:
@@ -1,6 +1,6 @@
 #pragma once
 #include "utility.h"
-#include "Hittable.h"
+#include "hittable.h"
 #include "bounding_box.h"
 #include <vector>
 
@@ -39,6 +39,27 @@ public:
         return hit_anything;
     }
 
+    bool occluded(const Ray& r, interval ray_t) const override {
+        for (const auto& object : objects) {
+            if (object->occluded(r, ray_t))
+                return true;
+        }
+        return false;
+    }
+
+    //each object only reports lanes it hits closer than the packet's current intervals
+    uint32_t hit_packet(ray_packet& packet, uint32_t active, hit_record* recs) const override {
+        uint32_t hits = 0;
+        for (const auto& object : objects)
+            hits |= object->hit_packet(packet, active, recs);
+        return hits;
+    }
+
+    void collect_lights(std::vector<const hittable*>& lights) const override {
+        for (const auto& object : objects)
+            object->collect_lights(lights);
+    }
+
     Bounding_Box bounding_box() const override { return bbox;}
 
     private:
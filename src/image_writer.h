@@ -0,0 +1,242 @@
+#pragma once
+
+#include <omp.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tile_scheduler.h"
+
+//Writes finished images to files in one bulk write. Pixels come in as linear float RGB, rows top to bottom.
+//.png and .ppm (binary P6) files get the same 8 bit gamma-corrected values as write_color,
+//.pfm and .raw files get the linear floats themselves (see Float_Image_Stream).
+
+//one value to 8 bit, as write_color does it
+inline uint8_t quantize_value(float linear) {
+    double gamma = linear > 0 ? std::sqrt(double(linear)) : 0;
+    return uint8_t(255.999 * std::min(gamma, 0.999));
+}
+
+//Linear floats to 8 bit with write_color's sqrt gamma and clamping, over all cores.
+//The SSE path does 4 values per step in double precision, so the bytes match write_color exactly.
+//(The plain loop does not vectorize on its own: sqrt may set errno.)
+inline std::vector<uint8_t> quantize(const std::vector<float>& rgb) {
+    std::vector<uint8_t> bytes(rgb.size());
+    const float* in = rgb.data();
+    uint8_t* out = bytes.data();
+    long long blocks = (long long)rgb.size() / 4;
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #pragma omp parallel for schedule(static)
+    for (long long block = 0; block < blocks; block++) {
+        const __m128d cap = _mm_set1_pd(0.999), scale = _mm_set1_pd(255.999);
+        //max returns its second operand for NaN, so NaN becomes 0 as in write_color
+        __m128 linear = _mm_max_ps(_mm_loadu_ps(in + 4 * block), _mm_setzero_ps());
+        __m128d low = _mm_mul_pd(_mm_min_pd(_mm_sqrt_pd(_mm_cvtps_pd(linear)), cap), scale);
+        __m128d high = _mm_mul_pd(_mm_min_pd(_mm_sqrt_pd(_mm_cvtps_pd(_mm_movehl_ps(linear, linear))), cap), scale);
+        __m128i values = _mm_unpacklo_epi64(_mm_cvttpd_epi32(low), _mm_cvttpd_epi32(high));
+        values = _mm_packus_epi16(_mm_packs_epi32(values, values), values);
+        int32_t packed = _mm_cvtsi128_si32(values);
+        std::memcpy(out + 4 * block, &packed, 4);
+    }
+#else
+    blocks = 0;
+#endif
+
+    #pragma omp parallel for schedule(static)
+    for (long long k = 4 * blocks; k < (long long)rgb.size(); k++)
+        out[k] = quantize_value(in[k]);
+    return bytes;
+}
+
+//text P3 PPM, as the renderer has always written to stdout
+inline void write_ppm_text(std::ostream& out, int width, int height, const std::vector<uint8_t>& bytes) {
+    static const std::array<std::string, 256> decimal = [] {
+        std::array<std::string, 256> table;
+        for (int value = 0; value < 256; value++)
+            table[value] = std::to_string(value);
+        return table;
+    }();
+
+    std::string text = "P3\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+    text.reserve(text.size() + bytes.size() * 4);
+    for (size_t k = 0; k < bytes.size(); k += 3) {
+        text += decimal[bytes[k]];
+        text += ' ';
+        text += decimal[bytes[k + 1]];
+        text += ' ';
+        text += decimal[bytes[k + 2]];
+        text += '\n';
+    }
+    out.write(text.data(), std::streamsize(text.size()));
+}
+
+inline std::vector<uint8_t> encode_ppm(int width, int height, const std::vector<uint8_t>& bytes) {
+    std::string header = "P6\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+    std::vector<uint8_t> file(header.begin(), header.end());
+    file.insert(file.end(), bytes.begin(), bytes.end());
+    return file;
+}
+
+//PNG with the image data in stored (uncompressed) deflate blocks, so no zlib is needed.
+//The file is about the size of a binary PPM.
+inline std::vector<uint8_t> encode_png(int width, int height, const std::vector<uint8_t>& bytes) {
+    static const std::array<uint32_t, 256> crc_table = [] {
+        std::array<uint32_t, 256> table;
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    std::vector<uint8_t> file = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    auto put32 = [](std::vector<uint8_t>& v, uint32_t x) {
+        v.push_back(uint8_t(x >> 24)); v.push_back(uint8_t(x >> 16)); v.push_back(uint8_t(x >> 8)); v.push_back(uint8_t(x));
+    };
+    auto chunk = [&](const char* type, const std::vector<uint8_t>& data) {
+        put32(file, uint32_t(data.size()));
+        size_t start = file.size();
+        file.insert(file.end(), type, type + 4);
+        file.insert(file.end(), data.begin(), data.end());
+        uint32_t crc = 0xffffffffu;
+        for (size_t k = start; k < file.size(); k++)
+            crc = crc_table[(crc ^ file[k]) & 0xff] ^ (crc >> 8);
+        put32(file, crc ^ 0xffffffffu);
+    };
+
+    std::vector<uint8_t> header;
+    put32(header, uint32_t(width));
+    put32(header, uint32_t(height));
+    header.insert(header.end(), { 8, 2, 0, 0, 0 }); //8 bit RGB, no interlace
+    chunk("IHDR", header);
+
+    //each row starts with filter type 0 (none)
+    size_t row_bytes = size_t(width) * 3;
+    std::vector<uint8_t> raw;
+    raw.reserve((row_bytes + 1) * height);
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), bytes.begin() + y * row_bytes, bytes.begin() + (y + 1) * row_bytes);
+    }
+
+    //zlib stream: header, stored blocks of at most 65535 bytes, Adler-32 of the raw data
+    std::vector<uint8_t> zlib = { 0x78, 0x01 };
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    for (size_t start = 0; ; start += 65535) {
+        size_t length = std::min<size_t>(65535, raw.size() - start);
+        bool last = start + length >= raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(uint8_t(length)); zlib.push_back(uint8_t(length >> 8));
+        zlib.push_back(uint8_t(~length)); zlib.push_back(uint8_t(~length >> 8));
+        zlib.insert(zlib.end(), raw.begin() + start, raw.begin() + start + length);
+        if (last)
+            break;
+    }
+    uint32_t a = 1, b = 0;
+    for (size_t k = 0; k < raw.size(); k++) {
+        a = (a + raw[k]) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32(zlib, (b << 16) | a);
+    chunk("IDAT", zlib);
+    chunk("IEND", {});
+    return file;
+}
+
+inline bool ends_with(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+inline bool is_float_format(const std::string& path) { return ends_with(path, ".pfm") || ends_with(path, ".raw"); }
+
+//Linear float image written a tile at a time, straight to its place in the file, so the full image never
+//has to exist as a float buffer. .pfm files get the Portable Float Map header ("PF", size, -1 for little
+//endian) and rows bottom to top, as the format stores them. .raw files get a 16 byte header
+//("RAWF", width, height, channels as 32 bit little endian ints) and rows top to bottom.
+//Values are 32 bit floats, RGB interleaved. write_tile may be called from several threads.
+class Float_Image_Stream {
+    public:
+    Float_Image_Stream(const std::string& path, int width, int height)
+    : path(path), width(width), height(height), bottom_up(ends_with(path, ".pfm")),
+      file(path, std::ios::binary | std::ios::trunc)
+    {
+        std::string header;
+        if (bottom_up)
+            header = "PF\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n-1.0\n";
+        else {
+            int32_t fields[3] = { width, height, 3 };
+            header.assign("RAWF");
+            header.append(reinterpret_cast<const char*>(fields), sizeof(fields));
+        }
+        file.write(header.data(), std::streamsize(header.size()));
+        header_size = std::streamoff(header.size());
+    }
+
+    //rgb holds the tile's pixels, tile.width() x 3 floats per row, rows top to bottom
+    void write_tile(const render_tile& tile, const float* rgb) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (int y = tile.y0; y < tile.y1; y++) {
+            int row = bottom_up ? height - 1 - y : y;
+            file.seekp(header_size + (std::streamoff(row) * width + tile.x0) * 3 * std::streamoff(sizeof(float)));
+            file.write(reinterpret_cast<const char*>(rgb + size_t(y - tile.y0) * tile.width() * 3),
+                       std::streamsize(tile.width() * 3 * sizeof(float)));
+        }
+    }
+
+    //flushes the file, reporting on std::cerr if anything failed
+    bool close() {
+        file.close();
+        if (file.fail()) {
+            std::cerr << "ERROR: Could not write image file '" << path << "'.\n";
+            return false;
+        }
+        return true;
+    }
+
+    private:
+    std::string path;
+    int width, height;
+    bool bottom_up;
+    std::ofstream file;
+    std::streamoff header_size = 0;
+    std::mutex lock;
+};
+
+//Writes the image to path, in the format its extension names (.png, .pfm, .raw, anything else binary PPM).
+//Returns false, after reporting on std::cerr, if the file cannot be written.
+inline bool write_image_file(const std::string& path, int width, int height, const std::vector<float>& rgb) {
+    if (is_float_format(path)) {
+        Float_Image_Stream stream(path, width, height);
+        stream.write_tile(render_tile{ 0, 0, width, height }, rgb.data());
+        return stream.close();
+    }
+
+    std::vector<uint8_t> file;
+    if (ends_with(path, ".png"))
+        file = encode_png(width, height, quantize(rgb));
+    else
+        file = encode_ppm(width, height, quantize(rgb));
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(file.data()), std::streamsize(file.size()));
+    if (!out) {
+        std::cerr << "ERROR: Could not write image file '" << path << "'.\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "hittable.h"
+#include "transform.h"
+
+//Places a shared object (usually a mesh or BVH built once, the bottom level) into the world with an affine transform.
+//Rays are moved into the object's space instead of copying its geometry, so any number of instances cost one
+//transform pair each. A Linear_BVH over the instances forms the top level.
+class Instance : public hittable {
+    public:
+    Instance(shared_ptr<hittable> object, const Affine_Transform& object_to_world)
+    : object(object), object_to_world(object_to_world), world_to_object(object_to_world.inverse())
+    {
+        Bounding_Box object_box = object->bounding_box();
+        bool empty = object_box.x.size() < 0 || object_box.y.size() < 0 || object_box.z.size() < 0;
+        bbox = empty ? Bounding_Box::empty : object_to_world.box(object_box);
+    }
+
+    bool hit(const Ray& r, interval ray_t, hit_record& rec) const override
+    {
+        //the direction is not renormalized, so hit times are the same in both spaces
+        Ray object_ray(world_to_object.point(r.origin), world_to_object.vector(r.direction), r.time);
+
+        if (!object->hit(object_ray, ray_t, rec))
+            return false;
+
+        to_world(rec);
+        return true;
+    }
+
+    bool occluded(const Ray& r, interval ray_t) const override
+    {
+        return object->occluded(Ray(world_to_object.point(r.origin), world_to_object.vector(r.direction), r.time), ray_t);
+    }
+
+    uint32_t hit_packet(ray_packet& packet, uint32_t active, hit_record* recs) const override
+    {
+        ray_packet object_packet;
+        for (int lane = 0; lane < packet.size; lane++) {
+            const Ray& r = packet.rays[lane];
+            object_packet.add(Ray(world_to_object.point(r.origin), world_to_object.vector(r.direction), r.time), packet.ray_t[lane]);
+        }
+
+        uint32_t hits = object->hit_packet(object_packet, active, recs);
+        for (int lane = 0; lane < packet.size; lane++) {
+            if (hits & (1u << lane)) {
+                to_world(recs[lane]);
+                packet.set_closest(lane, recs[lane].t);
+            }
+        }
+
+        return hits;
+    }
+
+    Bounding_Box bounding_box() const override { return bbox; }
+
+    const Affine_Transform& transform() const { return object_to_world; }
+
+    private:
+    shared_ptr<hittable> object;
+    Affine_Transform object_to_world;
+    Affine_Transform world_to_object;   //cached inverse
+    Bounding_Box bbox;
+
+    //Normals map by the inverse transpose. The normal keeps its side relative to the ray,
+    //so front_face stays valid.
+    void to_world(hit_record& rec) const {
+        rec.collision = object_to_world.point(rec.collision);
+        rec.normal = unit_vector(world_to_object.transpose_vector(rec.normal));
+    }
+};
@@ -0,0 +1,612 @@
+#pragma once
+
+#include "hittable.h"
+#include "bounding_box.h"
+#include "hittable_list.h"
+#include "bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+//32 byte node of a flattened BVH. Nodes are stored depth-first, so the first child
+//of an interior node is always the very next node and only the second child needs an offset.
+struct linear_bvh_node {
+    float bounds[2][3];     //[0] = minimum corner, [1] = maximum corner
+    union {
+        uint32_t primitives_offset;    //leaf: first primitive of the leaf range
+        uint32_t second_child_offset;  //interior: index of the second child
+    };
+    uint16_t primitive_count;   //0 for interior nodes
+    uint8_t axis;               //interior: axis the children were split along
+    uint8_t pad;
+
+    bool is_leaf() const { return primitive_count > 0; }
+
+    Bounding_Box bounding_box() const {
+        return Bounding_Box(interval(bounds[0][0], bounds[1][0]),
+                            interval(bounds[0][1], bounds[1][1]),
+                            interval(bounds[0][2], bounds[1][2]));
+    }
+
+    //store a double precision box, rounding outwards so the float box still encloses it
+    void set_bounds(const Bounding_Box& box) {
+        for (int axis_index = 0; axis_index < 3; axis_index++) {
+            const interval& extent = box.axis_interval(axis_index);
+            bounds[0][axis_index] = round_down(extent.min);
+            bounds[1][axis_index] = round_up(extent.max);
+        }
+    }
+
+    //slab test of the node box. inv_dir and dir_is_neg come from the ray direction.
+    bool hit(const point3& origin, const Vec3& inv_dir, const int dir_is_neg[3], interval ray_t) const {
+        for (int axis_index = 0; axis_index < 3; axis_index++) {
+            double near = (bounds[dir_is_neg[axis_index]][axis_index] - origin[axis_index]) * inv_dir[axis_index];
+            double far = (bounds[1 - dir_is_neg[axis_index]][axis_index] - origin[axis_index]) * inv_dir[axis_index];
+
+            //written so a NaN from 0 * infinity leaves the interval untouched
+            if (near > ray_t.min) ray_t.min = near;
+            if (far < ray_t.max) ray_t.max = far;
+
+            if (ray_t.max < ray_t.min)
+                return false;
+        }
+        return true;
+    }
+
+    private:
+    static float round_down(double value) {
+        float f = float(value);
+        return (double(f) > value) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static float round_up(double value) {
+        float f = float(value);
+        return (double(f) < value) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must stay 32 bytes");
+
+//deepest tree the builder produces, and so the traversal stack size
+const int linear_bvh_max_depth = 64;
+
+//Builds a flattened BVH over a set of primitive boxes.
+//After build(), nodes holds the tree and primitive_order maps each leaf slot to the index of its primitive.
+//Subtrees of large ranges are built as OpenMP tasks and large ranges are binned and partitioned in
+//parallel chunks. The finished tree is the same for any number of threads.
+class linear_bvh_builder {
+    public:
+    std::vector<linear_bvh_node> nodes;
+    std::vector<uint32_t> primitive_order;
+    double build_seconds = 0;
+
+    linear_bvh_builder(const std::vector<Bounding_Box>& boxes, const bvh_build_options& options)
+    : boxes(boxes), options(options) {
+        max_leaf_size = std::min(std::max(1, options.max_leaf_size), 255);
+    }
+
+    void build() {
+        double start_time = omp_get_wtime();
+        size_t count = boxes.size();
+
+        nodes.clear();
+        primitive_order.resize(count);
+        if (count == 0)
+            return;
+
+        //a binary tree has fewer than two nodes per primitive
+        build_nodes.resize(2 * count);
+        build_node_count = 0;
+        centroids.resize(count);
+        scratch.resize(count);
+
+        #pragma omp parallel default(shared) if(count >= bvh_parallel_grain)
+        {
+            #pragma omp for
+            for (size_t i = 0; i < count; i++) {
+                primitive_order[i] = uint32_t(i);
+                centroids[i] = boxes[i].centroid();
+            }
+
+            #pragma omp single
+            build_recursive(0, count, 0);
+        }
+
+        //lay the nodes out depth-first
+        nodes.reserve(build_node_count);
+        flatten(0);
+
+        build_nodes = std::vector<build_node>();
+        centroids = std::vector<point3>();
+        scratch = std::vector<uint32_t>();
+
+        build_seconds = omp_get_wtime() - start_time;
+        std::clog << "BVH build: " << count << " primitives, " << nodes.size() << " nodes in "
+                  << build_seconds * 1000 << " ms\n";
+    }
+
+    private:
+    //node of the intermediate tree, in whatever order the build tasks created them
+    struct build_node {
+        Bounding_Box bounds;
+        uint32_t first;         //leaf: first slot of primitive_order, interior: first child
+        uint32_t second;        //interior: second child
+        uint16_t count;         //primitives in a leaf, 0 for interior nodes
+        uint8_t axis;
+    };
+
+    const std::vector<Bounding_Box>& boxes;
+    bvh_build_options options;
+    int max_leaf_size;
+
+    std::vector<build_node> build_nodes;
+    std::atomic<uint32_t> build_node_count{0};
+    std::vector<point3> centroids;
+    std::vector<uint32_t> scratch;  //partition buffer, a range only ever touches its own slots
+
+    //past this depth fall back to median splits, which bounds the depth by log2 of the object count
+    static const int balanced_depth = linear_bvh_max_depth / 2;
+
+    uint32_t build_recursive(size_t start, size_t end, int depth) {
+        size_t span = end - start;
+        size_t chunk_count = bvh_chunk_count(span);
+        auto chunk_begin = [&](size_t chunk) { return start + span * chunk / chunk_count; };
+
+        Bounding_Box bounds = Bounding_Box::empty;
+        if (chunk_count == 1) {
+            for (size_t i = start; i < end; i++)
+                bounds = Bounding_Box(bounds, boxes[primitive_order[i]]);
+        }
+        else {
+            std::vector<Bounding_Box> chunk_bounds(chunk_count, Bounding_Box::empty);
+            bvh_for_each_chunk(chunk_count, [&](size_t chunk) {
+                for (size_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++)
+                    chunk_bounds[chunk] = Bounding_Box(chunk_bounds[chunk], boxes[primitive_order[i]]);
+            });
+            for (const auto& b : chunk_bounds)
+                bounds = Bounding_Box(bounds, b);
+        }
+
+        uint32_t node_index = build_node_count.fetch_add(1, std::memory_order_relaxed);
+        build_node& node = build_nodes[node_index];
+        node.bounds = bounds;
+
+        bool small_enough = span <= size_t(max_leaf_size);
+        int axis = bounds.longest_axis();
+        size_t mid = start + span/2;
+
+        if (span == 1) {
+            make_leaf(node, start, end);
+            return node_index;
+        }
+
+        if (options.split_method == bvh_split_method::sah && depth < balanced_depth) {
+            auto split = find_sah_split(span, [&](size_t i) { return boxes[primitive_order[start + i]]; }, bounds, options);
+
+            //a leaf costs one intersection per primitive
+            if (small_enough && (split.axis < 0 || split.cost >= double(span))) {
+                make_leaf(node, start, end);
+                return node_index;
+            }
+
+            if (split.axis >= 0) {
+                axis = split.axis;
+                mid = partition(start, end, [&](uint32_t p) { return split.goes_left(centroids[p]); });
+            }
+            //otherwise the centroids coincide and an even split of the range is as good as any
+        }
+        else {
+            if (small_enough) {
+                make_leaf(node, start, end);
+                return node_index;
+            }
+
+            //same ordering as BVH_Node's median builder, minimum of each box along the longest axis
+            std::nth_element(primitive_order.begin() + start, primitive_order.begin() + mid, primitive_order.begin() + end,
+                [&](uint32_t a, uint32_t b) { return boxes[a].axis_interval(axis).min < boxes[b].axis_interval(axis).min; });
+        }
+
+        uint32_t first_child, second_child;
+
+        #pragma omp task default(shared) if(span >= bvh_parallel_grain)
+        first_child = build_recursive(start, mid, depth + 1);
+
+        second_child = build_recursive(mid, end, depth + 1);
+
+        #pragma omp taskwait
+
+        node.first = first_child;
+        node.second = second_child;
+        node.count = 0;
+        node.axis = uint8_t(axis);
+        return node_index;
+    }
+
+    void make_leaf(build_node& node, size_t start, size_t end) {
+        node.first = uint32_t(start);
+        node.count = uint16_t(end - start);
+        node.axis = 0;
+    }
+
+    //Moves the primitives of [start, end) that go left in front of the rest and returns the boundary.
+    //Large ranges are partitioned in parallel chunks through the scratch buffer.
+    template <typename GoesLeft>
+    size_t partition(size_t start, size_t end, GoesLeft goes_left) {
+        size_t span = end - start;
+        size_t chunk_count = bvh_chunk_count(span);
+        if (chunk_count == 1) {
+            auto middle = std::partition(primitive_order.begin() + start, primitive_order.begin() + end, goes_left);
+            return size_t(middle - primitive_order.begin());
+        }
+
+        auto chunk_begin = [&](size_t chunk) { return start + span * chunk / chunk_count; };
+
+        //count the left-going primitives of every chunk
+        std::vector<size_t> left_counts(chunk_count, 0);
+        bvh_for_each_chunk(chunk_count, [&](size_t chunk) {
+            for (size_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++)
+                left_counts[chunk] += goes_left(primitive_order[i]);
+        });
+
+        //prefix sums give every chunk its place in the left and right halves
+        std::vector<size_t> left_offsets(chunk_count), right_offsets(chunk_count);
+        size_t total_left = 0;
+        for (size_t chunk = 0; chunk < chunk_count; chunk++) {
+            left_offsets[chunk] = total_left;
+            total_left += left_counts[chunk];
+        }
+        for (size_t chunk = 0, right = total_left; chunk < chunk_count; chunk++) {
+            right_offsets[chunk] = right;
+            right += (chunk_begin(chunk + 1) - chunk_begin(chunk)) - left_counts[chunk];
+        }
+
+        bvh_for_each_chunk(chunk_count, [&](size_t chunk) {
+            size_t left = start + left_offsets[chunk];
+            size_t right = start + right_offsets[chunk];
+            for (size_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++) {
+                uint32_t p = primitive_order[i];
+                scratch[goes_left(p) ? left++ : right++] = p;
+            }
+        });
+
+        bvh_for_each_chunk(chunk_count, [&](size_t chunk) {
+            std::copy(scratch.begin() + chunk_begin(chunk), scratch.begin() + chunk_begin(chunk + 1),
+                      primitive_order.begin() + chunk_begin(chunk));
+        });
+
+        return start + total_left;
+    }
+
+    //copies the subtree at build_index into nodes in depth-first order
+    uint32_t flatten(uint32_t build_index) {
+        const build_node& source = build_nodes[build_index];
+
+        uint32_t node_index = uint32_t(nodes.size());
+        nodes.emplace_back();
+        nodes[node_index].set_bounds(source.bounds);
+        nodes[node_index].primitive_count = source.count;
+        nodes[node_index].axis = source.axis;
+
+        if (source.count > 0) {
+            nodes[node_index].primitives_offset = source.first;
+            return node_index;
+        }
+
+        flatten(source.first);
+        nodes[node_index].second_child_offset = flatten(source.second);
+        return node_index;
+    }
+};
+
+//Expected query cost of a flattened BVH under the surface area heuristic, using the same
+//units as BVH_Node::sah_cost(): 1 per primitive intersection and traversal_cost per node visit.
+inline double linear_bvh_sah_cost(const std::vector<linear_bvh_node>& nodes, double traversal_cost = bvh_build_options().traversal_cost)
+{
+    if (nodes.empty())
+        return 0;
+
+    //weight each node by the probability a ray through the root also passes through it
+    double inv_root_area = 1.0 / std::max(nodes[0].bounding_box().surface_area(), 1e-300);
+    double cost = 0;
+    for (const auto& node : nodes) {
+        double probability = node.bounding_box().surface_area() * inv_root_area;
+        cost += probability * (node.is_leaf() ? double(node.primitive_count) : traversal_cost);
+    }
+    return cost;
+}
+
+//Walks a flattened BVH with an explicit stack, nearer child first. For every leaf the ray reaches,
+//calls intersect_leaf(first, count, ray_t) with the leaf's primitive range, which returns true
+//after lowering ray_t.max to a closer hit. Returns true if any leaf reported a hit.
+//root selects the subtree to walk, the whole tree by default. An any-hit query stops at the first leaf reporting a hit.
+template <typename LeafFn>
+bool linear_bvh_traverse(const std::vector<linear_bvh_node>& nodes, const Ray& r, interval ray_t, LeafFn intersect_leaf,
+                         uint32_t root = 0, bvh_query query = bvh_query::closest)
+{
+    if (nodes.empty())
+        return false;
+
+    const Vec3& inv_dir = r.inv_direction;
+    const int* dir_is_neg = r.dir_is_neg;
+
+    uint32_t stack[linear_bvh_max_depth];
+    int stack_size = 0;
+    uint32_t current = root;
+    bool hit_anything = false;
+
+    while (true) {
+        const linear_bvh_node& node = nodes[current];
+
+        if (node.hit(r.origin, inv_dir, dir_is_neg, ray_t)) {
+            if (node.is_leaf()) {
+                if (intersect_leaf(node.primitives_offset, uint32_t(node.primitive_count), ray_t)) {
+                    hit_anything = true;
+                    if (query == bvh_query::any)
+                        return true;
+                }
+            }
+            else if (dir_is_neg[node.axis]) {
+                //ray travels towards the second child first
+                stack[stack_size++] = current + 1;
+                current = node.second_child_offset;
+                continue;
+            }
+            else {
+                stack[stack_size++] = node.second_child_offset;
+                current = current + 1;
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+//Walks a flattened BVH with a whole packet of rays. Each node's box is tested against all active lanes at once
+//and the node is entered with the lanes that hit it. A lane left on its own, or a packet whose rays point
+//into different octants, finishes with single ray traversal. For every leaf a lane reaches, calls
+//intersect_leaf(first, count, lane, ray_t), which returns true after lowering ray_t.max to a closer hit.
+//Returns the mask of lanes that hit something.
+template <typename LeafFn>
+uint32_t linear_bvh_traverse_packet(const std::vector<linear_bvh_node>& nodes, ray_packet& packet, uint32_t active, LeafFn intersect_leaf)
+{
+    if (nodes.empty())
+        return 0;
+
+    uint32_t hits = 0;
+
+    //traces one lane alone through the subtree at root
+    auto trace_lane = [&](int lane, uint32_t root) {
+        interval ray_t = packet.ray_t[lane];
+        bool hit_lane = linear_bvh_traverse(nodes, packet.rays[lane], ray_t, [&](uint32_t first, uint32_t count, interval& leaf_t) {
+            if (!intersect_leaf(first, count, lane, leaf_t))
+                return false;
+            packet.set_closest(lane, leaf_t.max);
+            return true;
+        }, root);
+        if (hit_lane)
+            hits |= 1u << lane;
+    };
+
+    if (!packet.coherent(active)) {
+        for (int lane = 0; lane < packet.size; lane++) {
+            if (active & (1u << lane))
+                trace_lane(lane, 0);
+        }
+        return hits;
+    }
+
+    //child order follows the first active lane, which all others agree with
+    int first_lane = 0;
+    while (!(active & (1u << first_lane)))
+        first_lane++;
+    bool dir_is_neg[3] = { packet.dir_is_neg[0][first_lane] != 0, packet.dir_is_neg[1][first_lane] != 0, packet.dir_is_neg[2][first_lane] != 0 };
+
+    struct stack_entry {
+        uint32_t node;
+        uint32_t active;    //lanes that entered the parent
+    };
+    //every level pops one entry and pushes two
+    stack_entry stack[linear_bvh_max_depth + 1];
+    int stack_size = 0;
+    stack[stack_size++] = { 0, active };
+
+    while (stack_size > 0) {
+        stack_entry entry = stack[--stack_size];
+        const linear_bvh_node& node = nodes[entry.node];
+
+        uint32_t lanes = ray_packet_hit_box(node.bounds, packet, entry.active);
+        if (!lanes)
+            continue;
+
+        //a single lane gains nothing from the packet
+        if (!(lanes & (lanes - 1))) {
+            int lane = 0;
+            while (!(lanes & (1u << lane)))
+                lane++;
+            trace_lane(lane, entry.node);
+            continue;
+        }
+
+        if (node.is_leaf()) {
+            for (int lane = 0; lane < packet.size; lane++) {
+                if (!(lanes & (1u << lane)))
+                    continue;
+                interval leaf_t = packet.ray_t[lane];
+                if (intersect_leaf(node.primitives_offset, uint32_t(node.primitive_count), lane, leaf_t)) {
+                    packet.set_closest(lane, leaf_t.max);
+                    hits |= 1u << lane;
+                }
+            }
+        }
+        else if (dir_is_neg[node.axis]) {
+            //packet travels towards the second child first
+            stack[stack_size++] = { entry.node + 1, lanes };
+            stack[stack_size++] = { node.second_child_offset, lanes };
+        }
+        else {
+            stack[stack_size++] = { node.second_child_offset, lanes };
+            stack[stack_size++] = { entry.node + 1, lanes };
+        }
+    }
+
+    return hits;
+}
+
+//BVH flattened into one contiguous array of 32 byte nodes.
+//Traversal is iterative with an explicit stack, visiting the nearer child first.
+class Linear_BVH : public hittable {
+    public:
+    Linear_BVH(const hittable_list& list, const bvh_build_options& options = bvh_build_options())
+    : Linear_BVH(list.objects, options) {}
+
+    Linear_BVH(const std::vector<shared_ptr<hittable>>& objects, const bvh_build_options& options = bvh_build_options())
+    : options(options) {
+        build(objects);
+    }
+
+    bool hit(const Ray& r, interval ray_t, hit_record& rec) const override {
+        return linear_bvh_traverse(nodes, r, ray_t, [&](uint32_t first, uint32_t count, interval& leaf_t) {
+            bool hit_leaf = false;
+            for (uint32_t i = first; i < first + count; i++) {
+                if (primitives[i]->hit(r, leaf_t, rec)) {
+                    hit_leaf = true;
+                    //only look for hits closer than this one from now on
+                    leaf_t.max = rec.t;
+                }
+            }
+            return hit_leaf;
+        });
+    }
+
+    bool occluded(const Ray& r, interval ray_t) const override {
+        return linear_bvh_traverse(nodes, r, ray_t, [&](uint32_t first, uint32_t count, interval& leaf_t) {
+            for (uint32_t i = first; i < first + count; i++) {
+                if (primitives[i]->occluded(r, leaf_t))
+                    return true;
+            }
+            return false;
+        }, 0, bvh_query::any);
+    }
+
+    uint32_t hit_packet(ray_packet& packet, uint32_t active, hit_record* recs) const override {
+        return linear_bvh_traverse_packet(nodes, packet, active, [&](uint32_t first, uint32_t count, int lane, interval& leaf_t) {
+            bool hit_leaf = false;
+            for (uint32_t i = first; i < first + count; i++) {
+                if (primitives[i]->hit(packet.rays[lane], leaf_t, recs[lane])) {
+                    hit_leaf = true;
+                    leaf_t.max = recs[lane].t;
+                }
+            }
+            return hit_leaf;
+        });
+    }
+
+    void collect_lights(std::vector<const hittable*>& lights) const override {
+        for (const auto& object : primitives)
+            object->collect_lights(lights);
+    }
+
+    Bounding_Box bounding_box() const override { return bbox; }
+
+    double sah_cost(double traversal_cost = bvh_build_options().traversal_cost) const {
+        return linear_bvh_sah_cost(nodes, traversal_cost);
+    }
+
+    size_t node_count() const { return nodes.size(); }
+
+    //Recomputes every node box bottom-up from the current primitive boxes, keeping the tree topology.
+    //Call after primitives have moved, e.g. between animation frames. Subtrees are refit as parallel tasks.
+    void refit() {
+        if (nodes.empty())
+            return;
+
+        #pragma omp parallel if(nodes.size() >= 2 * bvh_parallel_grain && !omp_in_parallel())
+        #pragma omp single
+        refit_node(0);
+
+        bbox = nodes[0].bounding_box();
+    }
+
+    //Refits the tree, then rebuilds it from scratch if refitting has let its SAH cost grow
+    //past max_cost_growth times the cost right after the last build. Returns true if it rebuilt.
+    bool update(double max_cost_growth = 1.5) {
+        refit();
+        if (sah_cost(options.traversal_cost) <= max_cost_growth * built_cost)
+            return false;
+
+        //primitives are already in leaf order, which the rebuild does not depend on
+        std::vector<shared_ptr<hittable>> objects = std::move(primitives);
+        primitives.clear();
+        build(objects);
+        return true;
+    }
+
+    //SAH cost of the tree when it was last built
+    double build_sah_cost() const { return built_cost; }
+
+    private:
+    std::vector<linear_bvh_node> nodes;
+    std::vector<shared_ptr<hittable>> primitives;
+    Bounding_Box bbox;
+    bvh_build_options options;
+    double built_cost = 0;
+
+    void build(const std::vector<shared_ptr<hittable>>& objects) {
+        std::vector<Bounding_Box> boxes(objects.size());
+        #pragma omp parallel for if(objects.size() >= bvh_parallel_grain)
+        for (size_t i = 0; i < objects.size(); i++)
+            boxes[i] = objects[i]->bounding_box();
+
+        linear_bvh_builder builder(boxes, options);
+        builder.build();
+        nodes = std::move(builder.nodes);
+
+        //store the objects in leaf order so a leaf range indexes them directly
+        primitives.reserve(objects.size());
+        for (auto index : builder.primitive_order)
+            primitives.push_back(objects[index]);
+
+        bbox = nodes.empty() ? Bounding_Box::empty : nodes[0].bounding_box();
+        built_cost = sah_cost(options.traversal_cost);
+    }
+
+    void refit_node(uint32_t index) {
+        linear_bvh_node& node = nodes[index];
+
+        if (node.is_leaf()) {
+            Bounding_Box box = Bounding_Box::empty;
+            for (uint32_t i = node.primitives_offset; i < node.primitives_offset + node.primitive_count; i++)
+                box = Bounding_Box(box, primitives[i]->bounding_box());
+            node.set_bounds(box);
+            return;
+        }
+
+        uint32_t first = index + 1;
+        uint32_t second = node.second_child_offset;
+
+        //the first child's subtree fills the nodes up to the second child
+        if (second - first >= bvh_parallel_grain) {
+            #pragma omp task default(shared)
+            refit_node(first);
+            refit_node(second);
+            #pragma omp taskwait
+        }
+        else {
+            refit_node(first);
+            refit_node(second);
+        }
+
+        //float bounds merge exactly, no rounding needed
+        for (int axis = 0; axis < 3; axis++) {
+            node.bounds[0][axis] = std::min(nodes[first].bounds[0][axis], nodes[second].bounds[0][axis]);
+            node.bounds[1][axis] = std::max(nodes[first].bounds[1][axis], nodes[second].bounds[1][axis]);
+        }
+    }
+};
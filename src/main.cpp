@@ -7,10 +7,157 @@
 #include "triangle.h"
 #include "camera.h"
 #include "bvh.h"
+#include "linear_bvh.h"
 #include "quad.h"
 #include "obj_mesh.h"
+#include "instance.h"
 #include "volume.h"
 
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <string>
+
+//Command line options, applied to the camera of whichever scene runs (see render below).
+//A render split over several processes or machines gives each part a region or a sample range and
+//a checkpoint, then combines the checkpoints with Raytracer_Merge (tools/merge.cpp).
+//  --scene N                   scene to render, numbered as in main (default 5)
+//  --region X0 Y0 X1 Y1        render only the pixels [X0, X1) x [Y0, Y1)
+//  --samples FIRST COUNT       take COUNT samples per pixel, numbered from FIRST
+//  --seed S                    seed of all random numbers (default 0); parts need the same seed to merge into the single process image
+//  --sampler NAME              independent (default), stratified, halton, sobol or bluenoise, see sampler.h
+//  --output PATH               write the image to PATH instead of stdout
+//  --checkpoint PATH           save the pixel estimates to PATH (the part's output for merging)
+//  --frames N                  render N frames of an animated scene (13), moving its objects between frames;
+//                              frame K goes to PATH with _K before the extension, so --output is needed
+struct render_options {
+    int scene = 5;
+    render_tile region = { 0, 0, 0, 0 };
+    int first_sample = 0;
+    int sample_count = 0; //0 keeps the scene's samples_per_pixel
+    uint64_t seed = 0;
+    std::string sampler;
+    std::string output_path;
+    std::string checkpoint_path;
+    int frames = 1;
+};
+
+static render_options options;
+
+void apply_options(Camera& cam) {
+    //strata come from the scene's full sample count, the same for every part of a split render
+    if (!options.sampler.empty())
+        cam.pixel_sampler = make_sampler(options.sampler, cam.samples_per_pixel);
+    cam.region = options.region;
+    cam.first_sample = options.first_sample;
+    if (options.sample_count > 0)
+        cam.samples_per_pixel = options.sample_count;
+    cam.seed = options.seed;
+    if (!options.output_path.empty())
+        cam.output_path = options.output_path;
+    if (!options.checkpoint_path.empty())
+        cam.checkpoint_path = options.checkpoint_path;
+}
+
+void render(Camera& cam, const hittable& world) {
+    apply_options(cam);
+    cam.render(world);
+}
+
+//path with _frame inserted before its extension, e.g. image_3.png
+std::string frame_path(const std::string& path, int frame) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = path.size();
+    return path.substr(0, dot) + "_" + std::to_string(frame) + path.substr(dot);
+}
+
+//Renders options.frames frames of an animation. Before each frame after the first, move(frame) puts the objects
+//where they are in that frame, and bvh is refit to them rather than rebuilt (see Linear_BVH::update).
+void render_frames(Camera& cam, Linear_BVH& bvh, const std::function<void(int)>& move) {
+    apply_options(cam);
+    if (options.frames == 1) {
+        cam.render(bvh);
+        return;
+    }
+    for (int frame = 0; frame < options.frames; frame++) {
+        if (frame > 0) {
+            auto start = std::chrono::steady_clock::now();
+            move(frame);
+            bool rebuilt = bvh.update();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            std::clog << "Frame " << frame << ": BVH " << (rebuilt ? "rebuilt" : "refit") << " in " << elapsed.count() << " ms\n";
+        }
+        cam.output_path = frame_path(options.output_path, frame);
+        if (!options.checkpoint_path.empty())
+            cam.checkpoint_path = frame_path(options.checkpoint_path, frame);
+        cam.render(bvh);
+    }
+}
+
+//false, after reporting on std::cerr, if the arguments are not understood
+bool parse_options(int argc, char* argv[]) {
+    for (int k = 1; k < argc; k++) {
+        std::string option = argv[k];
+        int values = option == "--region" ? 4 : option == "--samples" ? 2 : 1;
+        if (option != "--scene" && option != "--region" && option != "--samples" && option != "--seed" &&
+            option != "--sampler" && option != "--output" && option != "--checkpoint" && option != "--frames") {
+            std::cerr << "ERROR: Unknown option '" << option << "'.\n";
+            return false;
+        }
+        if (k + values >= argc) {
+            std::cerr << "ERROR: Missing value for '" << option << "'.\n";
+            return false;
+        }
+        char** value = argv + k + 1;
+        k += values;
+
+        if (option == "--scene")
+            options.scene = std::atoi(value[0]);
+        else if (option == "--region") {
+            options.region = { std::atoi(value[0]), std::atoi(value[1]), std::atoi(value[2]), std::atoi(value[3]) };
+            if (options.region.width() <= 0 || options.region.height() <= 0) {
+                std::cerr << "ERROR: The render region is empty.\n";
+                return false;
+            }
+        }
+        else if (option == "--samples") {
+            options.first_sample = std::atoi(value[0]);
+            options.sample_count = std::atoi(value[1]);
+            if (options.first_sample < 0 || options.sample_count <= 0) {
+                std::cerr << "ERROR: Invalid sample range.\n";
+                return false;
+            }
+        }
+        else if (option == "--seed")
+            options.seed = std::strtoull(value[0], nullptr, 10);
+        else if (option == "--sampler") {
+            options.sampler = value[0];
+            if (!make_sampler(options.sampler, 1)) {
+                std::cerr << "ERROR: Unknown sampler '" << options.sampler << "'.\n";
+                return false;
+            }
+        }
+        else if (option == "--frames") {
+            options.frames = std::atoi(value[0]);
+            if (options.frames <= 0) {
+                std::cerr << "ERROR: Invalid frame count.\n";
+                return false;
+            }
+        }
+        else if (option == "--output")
+            options.output_path = value[0];
+        else
+            options.checkpoint_path = value[0];
+    }
+    if (options.frames > 1 && options.output_path.empty()) {
+        std::cerr << "ERROR: --frames needs --output, frames cannot all go to stdout.\n";
+        return false;
+    }
+    return true;
+}
+
 void bouncing_spheres() {
     
     hittable_list world;
@@ -56,7 +203,11 @@ void bouncing_spheres() {
     auto material3 = make_shared<specular>(color(0.7, 0.6, 0.5), 0.0);
     world.add(make_shared<Sphere>(point3(4, 1, 0), 1.0, material3));
 
-    world = hittable_list(make_shared<BVH_Node>(world));
+    bvh_build_options sah_options;
+    sah_options.split_method = bvh_split_method::sah;
+    auto bvh = make_shared<Linear_BVH>(world, sah_options);
+    std::clog << "BVH SAH cost: " << bvh->sah_cost() << '\n';
+    world = hittable_list(bvh);
 
     Camera cam;
 
@@ -74,7 +225,7 @@ void bouncing_spheres() {
     cam.defocus_angle = 0.6;
     cam.focus_dist    = 10.0;
 
-    cam.render(world);
+    render(cam, world);
     
 
 }
@@ -103,7 +254,7 @@ void checkered_spheres() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    render(cam, world);
 
 
 }
@@ -129,7 +280,7 @@ void earth() {
 
     cam.defocus_angle = 0;
 
-    cam.render(hittable_list(globe));
+    render(cam, hittable_list(globe));
 }
 
 void triangles() {
@@ -158,7 +309,7 @@ void triangles() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    render(cam, world);
 }
 
 
@@ -221,7 +372,7 @@ void quads() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    render(cam, world);
 }
 
 void basic_lights() {
@@ -255,7 +406,7 @@ void basic_lights() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    render(cam, world);
 }
 
 void cornell_box() {
@@ -290,7 +441,7 @@ void cornell_box() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    render(cam, world);
 }
 
 
@@ -298,14 +449,12 @@ void cornell_box() {
 void first_model() {
     hittable_list world;
 
-    auto smooth_die = load_obj_mesh("models/dice-obj/dicea_LOD3.obj", true);
-    auto die = load_obj_mesh("models/dice-obj/dicea_LOD3.obj", false);
-
-    //world.add(die);
+    //loaded once, both dice are instances of the same mesh
+    auto die = load_obj_mesh("models/dice-obj/dicea_LOD3.obj", true);
 
     world.add(make_shared<Sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(color(1, 0, 0))));
-    world.add(make_shared<translate>(smooth_die, Vec3(0, 0.5, 0)));
-    world.add(make_shared<translate>(die, Vec3(-1, 0.5, 1.2)));
+    world.add(make_shared<Instance>(die, Affine_Transform::translation(Vec3(0, 0.5, 0))));
+    world.add(make_shared<Instance>(die, Affine_Transform::translation(Vec3(-1, 0.5, 1.2)) * Affine_Transform::rotation(Vec3(0,1,0), 30)));
 
     auto difflight = make_shared<emissive>(color(5,5,4));
     //world.add(make_shared<Sphere>(point3(0,7,0), 2, difflight));
@@ -327,7 +476,7 @@ void first_model() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    render(cam, world);
 }
 
 
@@ -354,7 +503,7 @@ void perlin() {
     cam.background        = color(0.70, 0.80, 1.00);
 
 
-    cam.render(world);
+    render(cam, world);
 }
 
 void cube_map() {
@@ -394,7 +543,7 @@ void cube_map() {
     cam.background        = color(0.70, 0.80, 1.00);
     cam.set_cubemap("cube_maps/Park2");
 
-    cam.render(world);
+    render(cam, world);
 }
 
  
@@ -421,7 +570,7 @@ void pretty_sphere() {
     cam.background        = color(0.70, 0.80, 1.00);
     cam.set_cubemap("cube_maps/Earth");
 
-    cam.render(world);
+    render(cam, world);
 }
 
 
@@ -464,7 +613,7 @@ void cornell_smoke() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    render(cam, world);
 }
 
 
@@ -500,7 +649,7 @@ void marble_gallery() {
     world.add(make_shared<Sphere>(point3(2.5, 3.5, 2), 0.4, light2));
     world.add(make_shared<quad>(point3(-4, 5, -5), Vec3(4, 0, 0), Vec3(0, 0, 3), make_shared<emissive>(color(2, 2, 2))));
 
-    world = hittable_list(make_shared<BVH_Node>(world));
+    world = hittable_list(make_shared<Linear_BVH>(world));
 
     Camera cam;
     cam.aspect_ratio      = 16.0 / 9.0;
@@ -517,7 +666,7 @@ void marble_gallery() {
     cam.defocus_angle = 0.6;
     cam.focus_dist    = 10.0;
 
-    cam.render(world);
+    render(cam, world);
 }
 
 
@@ -580,21 +729,28 @@ void motion_blur_symphony() {
     auto bright_gold = make_shared<emissive>(color(1.5, 1.2, 0.2));
 
     // Sine wave: mix of refractive and emissive
-    world.add(make_shared<Sphere>(point3(0, 1, -2), 0.4, sine_wave, red_glass));
+    std::vector<shared_ptr<Sphere>> moving;
+    moving.push_back(make_shared<Sphere>(point3(0, 1, -2), 0.4, sine_wave, red_glass));
     //world.add(make_shared<Sphere>(point3(0, 1, -2), 0.35, sine_wave_offset, bright_red));
 
     // Circle path: mix of metal and emissive
-    world.add(make_shared<Sphere>(point3(-2, 2, 0), 0.35, circle_path, blue_metal));
+    moving.push_back(make_shared<Sphere>(point3(-2, 2, 0), 0.35, circle_path, blue_metal));
     //world.add(make_shared<Sphere>(point3(-2, 2, 0), 0.3, circle_path_offset, bright_blue));
 
     // Figure eight: diffuse and emissive
-    world.add(make_shared<Sphere>(point3(3, 1.5, -1), 0.3, figure_eight, green_diffuse));
+    moving.push_back(make_shared<Sphere>(point3(3, 1.5, -1), 0.3, figure_eight, green_diffuse));
     //world.add(make_shared<Sphere>(point3(3, 1.5, -1), 0.25, figure_eight_offset, bright_green));
 
     // Helix: metal and emissive
-    world.add(make_shared<Sphere>(point3(0, 0.5, 3), 0.25, helix, gold_metal));
+    moving.push_back(make_shared<Sphere>(point3(0, 0.5, 3), 0.25, helix, gold_metal));
     //world.add(make_shared<Sphere>(point3(0, 0.5, 3), 0.2, helix_offset, bright_gold));
 
+    std::vector<point3> start_centers;
+    for (const auto& sphere : moving) {
+        world.add(sphere);
+        start_centers.push_back(sphere->get_center());
+    }
+
     // Stationary reference spheres
     world.add(make_shared<Sphere>(point3(-4, 0.3, -3), 0.3, make_shared<lambertian>(color(1, 0, 0))));
     world.add(make_shared<Sphere>(point3(4, 0.3, -3), 0.3, make_shared<lambertian>(color(0, 1, 0))));
@@ -604,7 +760,7 @@ void motion_blur_symphony() {
     world.add(make_shared<quad>(point3(-3, 5, -4), Vec3(6, 0, 0), Vec3(0, 0, 8), light));
     world.add(make_shared<Sphere>(point3(0, 4, 2), 0.6, make_shared<emissive>(color(2.5, 2, 3))));
 
-    world = hittable_list(make_shared<BVH_Node>(world));
+    Linear_BVH bvh(world);
 
     Camera cam;
     cam.aspect_ratio      = 16.0 / 9.0;
@@ -620,7 +776,15 @@ void motion_blur_symphony() {
 
     cam.defocus_angle = 0;  // No DOF to focus on motion blur
 
-    cam.render(world);
+    //with --frames, the moving spheres' paths turn once around the vertical axis over the animation
+    render_frames(cam, bvh, [&](int frame) {
+        double angle = 2 * pi * frame / options.frames;
+        for (size_t k = 0; k < moving.size(); k++) {
+            const point3& start = start_centers[k];
+            point3 center(start.x * std::cos(angle) - start.z * std::sin(angle), start.y, start.x * std::sin(angle) + start.z * std::cos(angle));
+            moving[k]->set_center(center);
+        }
+    });
 }
 
 
@@ -660,7 +824,7 @@ void crystal_garden() {
     world.add(make_shared<Sphere>(point3(2, 3.5, 3), 0.5, soft_light2));
     world.add(make_shared<quad>(point3(-2, 4.5, -3), Vec3(4, 0, 0), Vec3(0, 0, 2), make_shared<emissive>(color(2, 2, 2))));
 
-    world = hittable_list(make_shared<BVH_Node>(world));
+    world = hittable_list(make_shared<Linear_BVH>(world));
 
     Camera cam;
     cam.aspect_ratio      = 16.0 / 9.0;
@@ -677,7 +841,7 @@ void crystal_garden() {
     cam.defocus_angle = 1.5;  // Strong depth of field
     cam.focus_dist    = 8.0;
 
-    cam.render(world);
+    render(cam, world);
 }
 
 
@@ -716,7 +880,7 @@ void foggy_cathedral() {
     auto volumetric_light = make_shared<emissive>(color(4, 3.5, 3));
     world.add(make_shared<quad>(point3(-4, 7.5, -8), Vec3(8, 0, 0), Vec3(0, 0, 10), volumetric_light));
 
-    world = hittable_list(make_shared<BVH_Node>(world));
+    world = hittable_list(make_shared<Linear_BVH>(world));
 
     Camera cam;
     cam.aspect_ratio      = 16.0 / 9.0;
@@ -732,7 +896,7 @@ void foggy_cathedral() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    render(cam, world);
 }
 
 
@@ -766,7 +930,7 @@ void noisy_landscape() {
     world.add(make_shared<Sphere>(point3(-4, 4, -2), 0.7, glow1));
     world.add(make_shared<Sphere>(point3(3, 3, 2), 0.5, glow2));
 
-    world = hittable_list(make_shared<BVH_Node>(world));
+    world = hittable_list(make_shared<Linear_BVH>(world));
 
     Camera cam;
     cam.aspect_ratio      = 16.0 / 9.0;
@@ -783,7 +947,7 @@ void noisy_landscape() {
     cam.defocus_angle = 1.2;
     cam.focus_dist    = 12.0;
 
-    cam.render(world);
+    render(cam, world);
 }
 
 
@@ -827,7 +991,7 @@ void metallic_showcase() {
     world.add(make_shared<Sphere>(point3(0, 3, -3), 0.4, cool_light));
     world.add(make_shared<quad>(point3(-3, 5.5, -3), Vec3(6, 0, 0), Vec3(0, 0, 3), make_shared<emissive>(color(2, 2, 2))));
 
-    world = hittable_list(make_shared<BVH_Node>(world));
+    world = hittable_list(make_shared<Linear_BVH>(world));
 
     Camera cam;
     cam.aspect_ratio      = 16.0 / 9.0;
@@ -844,7 +1008,58 @@ void metallic_showcase() {
     cam.defocus_angle = 0.8;
     cam.focus_dist    = 12.0;
 
-    cam.render(world);
+    render(cam, world);
+}
+
+//a thousand benches sharing one mesh: one bottom level BVH, a top level BVH over the instances
+void bench_field() {
+    hittable_list world;
+
+    auto bench = load_obj_mesh("models/bench/bench.obj", true);
+
+    //scale the model to unit size, standing on y = 0
+    Bounding_Box bench_box = bench->bounding_box();
+    double bench_size = std::fmax(std::fmax(bench_box.x.size(), bench_box.y.size()), bench_box.z.size());
+    auto to_unit = Affine_Transform::scaling(1.0 / bench_size)
+                 * Affine_Transform::translation(Vec3(-bench_box.centroid().x, -bench_box.y.min, -bench_box.centroid().z));
+
+    hittable_list instances;
+    int rows = 25, columns = 40;
+    for (int i = 0; i < columns; i++) {
+        for (int j = 0; j < rows; j++) {
+            auto place = Affine_Transform::translation(Vec3(1.6*(i - columns/2) + random_double(-0.3, 0.3), 0, -1.6*j + random_double(-0.3, 0.3)))
+                       * Affine_Transform::rotation(Vec3(0,1,0), random_double(0, 360));
+            instances.add(make_shared<Instance>(bench, place * to_unit));
+        }
+    }
+
+    bvh_build_options sah_options;
+    sah_options.split_method = bvh_split_method::sah;
+    auto top_level = make_shared<Linear_BVH>(instances, sah_options);
+    std::clog << "Bench field: " << instances.objects.size() << " instances of one mesh, top level BVH "
+              << top_level->node_count() << " nodes, " << instances.objects.size() * sizeof(Instance) + top_level->node_count() * sizeof(linear_bvh_node)
+              << " bytes\n";
+    world.add(top_level);
+
+    world.add(make_shared<Sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(color(0.4, 0.5, 0.3))));
+    world.add(make_shared<Sphere>(point3(0,60,20), 25, make_shared<emissive>(color(6,6,5))));
+
+    Camera cam;
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 800;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 20;
+    cam.background        = color(0.5, 0.6, 0.8);
+
+    cam.vfov     = 45;
+    cam.position = point3(0, 6, 8);
+    cam.direction   = point3(0, 0, -15);
+    cam.up      = Vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    render(cam, world);
 }
 
 void final_scene() {
@@ -868,7 +1083,11 @@ void final_scene() {
 
     hittable_list world;
 
-    world.add(make_shared<BVH_Node>(boxes1));
+    bvh_build_options sah_options;
+    sah_options.split_method = bvh_split_method::sah;
+    auto ground_bvh = make_shared<Linear_BVH>(boxes1, sah_options);
+    std::clog << "Ground BVH SAH cost: " << ground_bvh->sah_cost() << '\n';
+    world.add(ground_bvh);
 
     auto light = make_shared<emissive>(color(7, 7, 7));
     world.add(make_shared<quad>(point3(123,554,147), Vec3(300,0,0), Vec3(0,0,265), light));
@@ -902,7 +1121,7 @@ void final_scene() {
     }
 
     world.add(make_shared<translate>(
-            make_shared<BVH_Node>(boxes2),
+            make_shared<Linear_BVH>(boxes2),
             Vec3(-100,270,395)
         )
     );
@@ -922,12 +1141,21 @@ void final_scene() {
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    render(cam, world);
 }
 
-int main()
+int main(int argc, char* argv[])
 {
-    switch(5) {
+    if (!parse_options(argc, argv))
+        return 1;
+    if (options.frames > 1 && options.scene != 13) {
+        std::cerr << "ERROR: Scene " << options.scene << " is not animated, --frames needs scene 13.\n";
+        return 1;
+    }
+    //random scenes are built on this thread, so every run with the same seed builds the same scene
+    random_seed(options.seed);
+
+    switch(options.scene) {
         case 1: bouncing_spheres(); break;
         case 2: checkered_spheres(); break;
         case 3: earth(); break;
@@ -946,5 +1174,6 @@ int main()
         case 16: noisy_landscape(); break;
         case 17: metallic_showcase(); break;
         case 18: final_scene(); break;
+        case 19: bench_field(); break;
     }
 }
@@ -3,21 +3,65 @@
 #include "hittable.h"
 #include "texture.h"
 
+//One direction picked by a material's sample. weight is what the path's throughput is multiplied by:
+//the BSDF times the cosine, divided by pdf, the density the direction was picked with per unit solid angle.
+//A delta lobe (a perfect mirror, glass) picks one exact direction, which evaluate and pdf never meet:
+//such samples are marked, and their pdf is left 0.
+struct scatter_sample {
+    Vec3 direction;
+    color weight;
+    double pdf = 0;
+    bool delta = false;
+};
+
 class material {
     public:
     virtual ~material() = default;
 
     //input: incoming ray, hit record data including the collision normal (defines reflectance behavior)
-    //output: color of the material hit, reflected ray
-    virtual bool scatter(const Ray& ray_in, const hit_record& rec, color& attenuation, Ray& scattered) const {
+    //output: a scattered direction with its weight and pdf; false if the light is absorbed
+    virtual bool sample(const Ray& ray_in, const hit_record& rec, scatter_sample& scattered) const {
       return false;
     }
 
+    //Light scattered back along ray_in per unit of light arriving from direction, cosine included:
+    //the BSDF times the cosine for surfaces, the phase function for volumes. Delta lobes are not included.
+    virtual color evaluate(const Ray& ray_in, const hit_record& rec, const Vec3& direction) const {
+      return color(0,0,0);
+    }
+
+    //density of sample picking direction, per unit solid angle, leaving out delta lobes
+    virtual double pdf(const Ray& ray_in, const hit_record& rec, const Vec3& direction) const {
+      return 0;
+    }
+
+    //True if the material scatters only through delta lobes, or not at all: evaluate is always 0 then,
+    //so sampling the lights from its surface gains nothing.
+    virtual bool is_delta() const {
+      return true;
+    }
+
+    //input: incoming ray, hit record data including the collision normal (defines reflectance behavior)
+    //output: color of the material hit, reflected ray
+    bool scatter(const Ray& ray_in, const hit_record& rec, color& attenuation, Ray& scattered) const {
+      scatter_sample picked;
+      if (!sample(ray_in, rec, picked))
+        return false;
+      attenuation = picked.weight;
+      scattered = Ray(rec.collision, picked.direction, ray_in.time);
+      return true;
+    }
+
     //If un-implemented, does not emit.
     virtual color emitted(double u, double v, const point3& p) const {
       return color(0,0,0);
     }
 
+    //true for materials that emit, whose shapes the camera samples as lights
+    virtual bool is_emissive() const {
+      return false;
+    }
+
 };
 
 class lambertian : public material{
@@ -26,18 +70,29 @@ class lambertian : public material{
     lambertian(shared_ptr<texture> tex) : tex(tex) {}
 
     //Returns true because it always reflects. 
-    bool scatter(const Ray& r_in, const hit_record& rec, color& attenuation, Ray& scattered) const override {
-        auto scatter_direction = rec.normal + random_unit_vector();
+    bool sample(const Ray& r_in, const hit_record& rec, scatter_sample& scattered) const override {
+        //cosine weighted about the normal, in closed form, so the weight is just the albedo
+        Vec3 normal = unit_vector(rec.normal);
+        double u1 = random_double();
+        warp_sample picked = warp_cosine_hemisphere(u1, random_double());
+        scattered.direction = onb(normal).to_world(picked.value);
+        scattered.pdf = picked.pdf;
+        scattered.weight = tex->value(rec.u, rec.v, rec.collision);
+        scattered.delta = false;
+        return true;
+    }
 
-        //Catch edge-case scatter direction
-        if (scatter_direction.near_zero())
-        {
-          scatter_direction = rec.normal;
-        }
+    //albedo / pi times the cosine to the normal
+    color evaluate(const Ray& r_in, const hit_record& rec, const Vec3& direction) const override {
+        return tex->value(rec.u, rec.v, rec.collision) * pdf(r_in, rec, direction);
+    }
 
-        scattered = Ray(rec.collision, scatter_direction, r_in.time);
-        attenuation = tex->value(rec.u, rec.v, rec.collision);
-        return true;
+    double pdf(const Ray& r_in, const hit_record& rec, const Vec3& direction) const override {
+        return cosine_hemisphere_pdf(dot(unit_vector(rec.normal), unit_vector(direction)));
+    }
+
+    bool is_delta() const override {
+        return false;
     }
 
   private:
@@ -50,28 +105,60 @@ class specular :public material {
     specular(shared_ptr<texture> tex, double fuzz) : tex(tex), fuzz(fuzz < 1 ? fuzz : 1) {}
 
 
-    bool scatter(const Ray& r_in, const hit_record& rec, color& attenuation, Ray& scattered) const override {
+    bool sample(const Ray& r_in, const hit_record& rec, scatter_sample& scattered) const override {
         //calculate reflection
-        Vec3 reflected = reflect(r_in.direction, rec.normal);
+        Vec3 reflected = unit_vector(reflect(r_in.direction, rec.normal));
         //add fuzziness
-        reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
-        scattered = Ray(rec.collision, reflected, r_in.time);
-        attenuation = tex->value(rec.u, rec.v, rec.collision);
+        scattered.direction = fuzz > 0 ? reflected + (fuzz * random_unit_vector()) : reflected;
+        scattered.weight = tex->value(rec.u, rec.v, rec.collision);
+        scattered.delta = fuzz <= 0;
+        scattered.pdf = scattered.delta ? 0 : fuzz_pdf(reflected, unit_vector(scattered.direction));
         //ignore ray if fuzziness offest sends it through the object of original ray incidence.
         return (dot(scattered.direction, rec.normal) > 0);
     }
 
+    //Every direction sample returns above the surface carries the albedo as its weight,
+    //so the BSDF times the cosine is the albedo times the density.
+    color evaluate(const Ray& r_in, const hit_record& rec, const Vec3& direction) const override {
+        if (dot(direction, rec.normal) <= 0)
+          return color(0,0,0);
+        return tex->value(rec.u, rec.v, rec.collision) * pdf(r_in, rec, direction);
+    }
+
+    double pdf(const Ray& r_in, const hit_record& rec, const Vec3& direction) const override {
+        if (fuzz <= 0)
+          return 0;
+        return fuzz_pdf(unit_vector(reflect(r_in.direction, rec.normal)), unit_vector(direction));
+    }
+
+    bool is_delta() const override {
+        return fuzz <= 0;
+    }
+
   private:
     shared_ptr<texture> tex;
     double fuzz;
+
+    //Density of the direction of reflected + fuzz * (uniform unit vector), for unit vectors reflected and direction.
+    //The ray along direction crosses the sphere of radius fuzz around reflected at distances t1, t2 (the roots of
+    //t^2 - 2 c t + 1 - fuzz^2, with c the cosine between the two), and each crossing adds
+    //t^2 / (|cosine to the sphere's normal| * 4 pi fuzz^2). Nonzero only within the cone the sphere fills.
+    double fuzz_pdf(const Vec3& reflected, const Vec3& direction) const {
+        double c = dot(reflected, direction);
+        double discriminant = c * c - (1 - fuzz * fuzz);
+        if (c <= 0 || discriminant <= 0)
+          return 0;
+        //t1^2 + t2^2 = (t1 + t2)^2 - 2 t1 t2, and both crossings meet the sphere at cosine sqrt(discriminant) / fuzz
+        return (4 * c * c - 2 * (1 - fuzz * fuzz)) / (4 * pi * fuzz * std::sqrt(discriminant));
+    }
 };
 
 class dielectric : public material {
   public:
     dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
-    bool scatter(const Ray& r_in, const hit_record& rec, color& attenuation, Ray& scattered) const override {
-      attenuation = color(1.0, 1.0, 1.0);
+    //reflects or refracts, both delta lobes, picked by the Fresnel reflectance
+    bool sample(const Ray& r_in, const hit_record& rec, scatter_sample& scattered) const override {
       double ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
 
       Vec3 unit_direction = unit_vector(r_in.direction);
@@ -90,7 +177,10 @@ class dielectric : public material {
       {
         direction = refract(unit_direction, rec.normal, ri);
       }
-      scattered = Ray(rec.collision, direction, r_in.time);
+      scattered.direction = direction;
+      scattered.weight = color(1.0, 1.0, 1.0);
+      scattered.pdf = 0;
+      scattered.delta = true;
       return true;
     }
   private:
@@ -117,6 +207,10 @@ class emissive : public material {
       return tex->value(u, v, p);
     }
 
+    bool is_emissive() const override {
+      return true;
+    }
+
   private:
     shared_ptr<texture> tex;
 };
@@ -127,12 +221,29 @@ class isotropic : public material{
     isotropic(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
     isotropic(shared_ptr<texture> tex) : tex(tex) {}
 
-    bool scatter(const Ray& r_in, const hit_record& rec, color& attenuation, Ray& scattered) const override {
-      scattered = Ray(rec.collision, random_unit_vector(), r_in.time);
-      attenuation = tex->value(rec.u, rec.v, rec.collision);
+    bool sample(const Ray& r_in, const hit_record& rec, scatter_sample& scattered) const override {
+      double u1 = random_double();
+      warp_sample picked = warp_uniform_sphere(u1, random_double());
+      scattered.direction = picked.value;
+      scattered.pdf = picked.pdf;
+      scattered.weight = tex->value(rec.u, rec.v, rec.collision);
+      scattered.delta = false;
       return true;
     }
 
+    //the phase function, the same 1 / (4 pi) in every direction
+    color evaluate(const Ray& r_in, const hit_record& rec, const Vec3& direction) const override {
+      return tex->value(rec.u, rec.v, rec.collision) * uniform_sphere_pdf();
+    }
+
+    double pdf(const Ray& r_in, const hit_record& rec, const Vec3& direction) const override {
+      return uniform_sphere_pdf();
+    }
+
+    bool is_delta() const override {
+      return false;
+    }
+
   private:
     shared_ptr<texture> tex;
 };
\ No newline at end of file
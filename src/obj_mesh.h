@@ -4,6 +4,9 @@
 #include "hittable.h"
 #include "triangle.h"
 #include "bvh.h"
+#include "triangle_mesh.h"
+
+#include <unordered_map>
 
 auto default_mat = make_shared<lambertian>(color(0.8, 0.8, 0.8));
 bool smooth = true;
@@ -55,7 +58,57 @@ shared_ptr<hittable> load_obj_mesh(const std::string& filename, bool smooth)
     }
 
 
-    shared_ptr<hittable_list> tris = make_shared<hittable_list>();
+    //default material sits at the end of the table, for faces without a valid material id
+    material_table.push_back(default_mat);
+    const uint16_t default_mat_id = uint16_t(material_table.size() - 1);
+
+    // Does every face in the file carry normals / texture coordinates?
+    bool has_normals = smooth;
+    bool has_uvs = true;
+    for (const auto& shape : shapes) {
+        for (const auto& idx : shape.mesh.indices) {
+            if (idx.normal_index < 0) has_normals = false;
+            if (idx.texcoord_index < 0) has_uvs = false;
+        }
+    }
+
+    // Shared vertex buffers. OBJ indexes positions, normals and uvs separately,
+    // so every distinct combination used by a face becomes one mesh vertex.
+    std::vector<float> positions, normals, uvs;
+    std::vector<uint32_t> indices;
+    std::vector<uint16_t> face_materials;
+
+    struct vertex_key {
+        int v, n, t;
+        bool operator==(const vertex_key& other) const { return v == other.v && n == other.n && t == other.t; }
+    };
+    struct vertex_key_hash {
+        size_t operator()(const vertex_key& k) const {
+            return std::hash<long long>()(((long long)k.v * 73856093) ^ ((long long)k.n * 19349663) ^ ((long long)k.t * 83492791));
+        }
+    };
+    std::unordered_map<vertex_key, uint32_t, vertex_key_hash> vertex_ids;
+
+    auto get_vertex = [&](tinyobj::index_t idx) {
+        vertex_key key = { idx.vertex_index, has_normals ? idx.normal_index : -1, has_uvs ? idx.texcoord_index : -1 };
+        auto found = vertex_ids.find(key);
+        if (found != vertex_ids.end())
+            return found->second;
+
+        uint32_t id = uint32_t(positions.size() / 3);
+        for (int i = 0; i < 3; i++)
+            positions.push_back(attrib.vertices[3 * idx.vertex_index + i]);
+        if (has_normals) {
+            for (int i = 0; i < 3; i++)
+                normals.push_back(attrib.normals[3 * idx.normal_index + i]);
+        }
+        if (has_uvs) {
+            uvs.push_back(attrib.texcoords[2 * idx.texcoord_index + 0]);
+            uvs.push_back(attrib.texcoords[2 * idx.texcoord_index + 1]);
+        }
+        vertex_ids.emplace(key, id);
+        return id;
+    };
 
     for (const auto& shape : shapes) {
         size_t index_offset = 0;
@@ -63,66 +116,27 @@ shared_ptr<hittable> load_obj_mesh(const std::string& filename, bool smooth)
         for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++) {
             int fv = shape.mesh.num_face_vertices[f]; // usually 3
 
-            tinyobj::index_t idx0 = shape.mesh.indices[index_offset + 0];
-            tinyobj::index_t idx1 = shape.mesh.indices[index_offset + 1];
-            tinyobj::index_t idx2 = shape.mesh.indices[index_offset + 2];
-
-            // ----- positions -----
-            auto get_v = [&](tinyobj::index_t idx) {
-                return point3(
-                    attrib.vertices[3 * idx.vertex_index + 0],
-                    attrib.vertices[3 * idx.vertex_index + 1],
-                    attrib.vertices[3 * idx.vertex_index + 2]
-                );
-            };
-
-            point3 v0 = get_v(idx0);
-            point3 v1 = get_v(idx1);
-            point3 v2 = get_v(idx2);
+            for (int corner = 0; corner < 3; corner++)
+                indices.push_back(get_vertex(shape.mesh.indices[index_offset + corner]));
 
             //materials
             int mat_id = shape.mesh.material_ids[f];
-            shared_ptr<material> mat;
-
-            if (mat_id >= 0 && mat_id < material_table.size())
-                mat = material_table[mat_id];
+            if (mat_id >= 0 && mat_id < int(material_table.size()) - 1)
+                face_materials.push_back(uint16_t(mat_id));
             else
-                mat = default_mat;
-
-
-            // ----- normals -----
-            bool has_normals =
-                idx0.normal_index >= 0 &&
-                idx1.normal_index >= 0 &&
-                idx2.normal_index >= 0;
-
-            if (has_normals && smooth) {
-                auto get_n = [&](tinyobj::index_t idx) {
-                    return Vec3(
-                        attrib.normals[3 * idx.normal_index + 0],
-                        attrib.normals[3 * idx.normal_index + 1],
-                        attrib.normals[3 * idx.normal_index + 2]
-                    );
-                };
-
-                Vec3 n0 = get_n(idx0);
-                Vec3 n1 = get_n(idx1);
-                Vec3 n2 = get_n(idx2);
-
-                tris->add(
-                    make_shared<Smooth_Triangle>(v0, v1, v2, n0, n1, n2, mat)
-                );
-
-            } else {
-                tris->add(
-                    make_shared<Triangle>(v0, v1, v2, mat)
-                );
-            }
+                face_materials.push_back(default_mat_id);
 
             index_offset += fv;
         }
     }
 
-    // return hittables list
-    return tris;
+    bvh_build_options options;
+    options.split_method = bvh_split_method::sah;
+    auto mesh = make_shared<Triangle_Mesh>(std::move(positions), std::move(normals), std::move(uvs),
+                                           std::move(indices), std::move(face_materials), std::move(material_table), options);
+
+    std::clog << "Loaded " << filename << ": " << mesh->face_count() << " triangles, " << mesh->vertex_count()
+              << " vertices, " << double(mesh->memory_bytes()) / std::max<size_t>(1, mesh->face_count()) << " bytes per triangle\n";
+
+    return mesh;
 }
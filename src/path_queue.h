@@ -0,0 +1,70 @@
+#pragma once
+
+#include "hittable.h"
+#include "color.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+//Paths in flight for the wavefront integrator, stored as one array per field (structure of arrays),
+//so each stage streams through only the fields it touches. A path whose depth is 0 has finished
+//and is waiting to hand its radiance to its pixel.
+struct path_queue {
+    std::vector<Ray> rays;
+    std::vector<hit_record> recs;
+    std::vector<uint8_t> hit;       //result of the last extend
+    std::vector<color> throughput;
+    std::vector<color> radiance;
+    std::vector<int> pixel;         //index into the tile buffer
+    std::vector<int> depth;         //segments the path may still trace
+    std::vector<int> bounce;
+    std::vector<double> scatter_pdf; //of the current ray's direction if its bounce sampled the lights, else 0
+    std::vector<sample_id> sample;  //the sample the path belongs to, for its random streams
+    std::vector<random_stream> rng; //random numbers of the current bounce, carried between stages
+
+    int size() const { return int(rays.size()); }
+
+    void push(const Ray& r, int pixel_index, int max_depth, const sample_id& id, const random_stream& stream) {
+        rays.push_back(r);
+        recs.emplace_back();
+        hit.push_back(0);
+        throughput.push_back(color(1, 1, 1));
+        radiance.push_back(color(0, 0, 0));
+        pixel.push_back(pixel_index);
+        depth.push_back(max_depth);
+        bounce.push_back(0);
+        scatter_pdf.push_back(0);
+        sample.push_back(id);
+        rng.push_back(stream);
+    }
+
+    //moves path from into slot to, for compaction (to <= from)
+    void move(int from, int to) {
+        rays[to] = rays[from];
+        recs[to] = std::move(recs[from]);
+        hit[to] = hit[from];
+        throughput[to] = throughput[from];
+        radiance[to] = radiance[from];
+        pixel[to] = pixel[from];
+        depth[to] = depth[from];
+        bounce[to] = bounce[from];
+        scatter_pdf[to] = scatter_pdf[from];
+        sample[to] = sample[from];
+        rng[to] = rng[from];
+    }
+
+    void resize(int count) {
+        rays.resize(count);
+        recs.resize(count);
+        hit.resize(count);
+        throughput.resize(count);
+        radiance.resize(count);
+        pixel.resize(count);
+        depth.resize(count);
+        bounce.resize(count);
+        scatter_pdf.resize(count);
+        sample.resize(count);
+        rng.resize(count);
+    }
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "color.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+//relative luminance of a linear color (Rec. 709 weights)
+inline double luminance(const color& c) {
+    return 0.2126 * c.r + 0.7152 * c.g + 0.0722 * c.b;
+}
+
+//Running estimate of one pixel: the sum of its samples, the sum of their squared luminances and the count,
+//which give the mean and the variance of the luminance without keeping the samples.
+//The color sum is kept in fixed point (2^-24 steps, far below one 8 bit step even after gamma). Integer addition
+//is exact, so the sum does not depend on the order samples arrive in: estimates merged from any split of the
+//samples, between passes, checkpoints or processes, are bit for bit the same as one run taking them all.
+struct pixel_estimate {
+    static constexpr double fixed_one = 16777216.0; //2^24
+    static constexpr double sample_limit = 1e9;     //larger samples are clamped, keeping sums within int64
+
+    int64_t sum_fixed[3] = { 0, 0, 0 };
+    double luminance_squares = 0;
+    int samples = 0;
+
+    //non-finite samples count as black, so one bad path cannot poison the pixel
+    void add(const color& sample) {
+        for (int channel = 0; channel < 3; channel++) {
+            double value = std::isfinite(sample[channel]) ? std::clamp(sample[channel], -sample_limit, sample_limit) : 0;
+            sum_fixed[channel] += std::llround(value * fixed_one);
+        }
+        double y = luminance(sample);
+        luminance_squares += std::isfinite(y) ? y * y : 0;
+        samples++;
+    }
+
+    void merge(const pixel_estimate& other) {
+        for (int channel = 0; channel < 3; channel++)
+            sum_fixed[channel] += other.sum_fixed[channel];
+        luminance_squares += other.luminance_squares;
+        samples += other.samples;
+    }
+
+    color sum() const { return color(sum_fixed[0] / fixed_one, sum_fixed[1] / fixed_one, sum_fixed[2] / fixed_one); }
+
+    color mean() const { return samples > 0 ? sum() / samples : color(0, 0, 0); }
+
+    //unbiased sample variance of the luminance
+    double variance() const {
+        if (samples < 2)
+            return infinity;
+        double y = luminance(sum());
+        return std::max(0.0, (luminance_squares - y * y / samples) / (samples - 1));
+    }
+
+    //Standard error of this pixel's mean luminance after the sqrt gamma of write_color, so the threshold
+    //is in display units (1/255 is one step of 8 bit output). Variance and mean come from the estimate of
+    //a window around the pixel: a pixel whose few samples all missed the light would otherwise look
+    //converged with zero variance. Dark windows are floored, since the gamma slope goes to infinity at black.
+    double display_error(const pixel_estimate& window) const {
+        double mean_luminance = std::max(luminance(window.mean()), 0.01);
+        return std::sqrt(window.variance() / std::max(1, samples)) / (2 * std::sqrt(mean_luminance));
+    }
+};
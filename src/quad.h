@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hittable.h"
+#include "material.h"
 
 class quad: public hittable {
     public:
@@ -10,6 +11,10 @@ class quad: public hittable {
         normal = unit_vector(n);
         D = dot(normal, Q);
         w = n / dot (n, n);
+        area = n.length();
+        rectangle = std::fabs(dot(u, v)) < 1e-9 * u.length() * v.length();
+
+        set_bounding_box();
     }
 
     virtual void set_bounding_box() {
@@ -46,6 +51,7 @@ class quad: public hittable {
         rec.collision = intersection;
         rec.t = t;
         rec.mat = mat;
+        rec.object = this;
         rec.set_face_normal(r, normal);
 
         return true;
@@ -64,6 +70,42 @@ class quad: public hittable {
         return true;
     }
 
+    void collect_lights(std::vector<const hittable*>& lights) const override {
+        if (mat->is_emissive())
+            lights.push_back(this);
+    }
+
+    //Rectangles are sampled uniformly by the solid angle they fill as seen from origin, as long as that is large
+    //enough to compute accurately, other quads uniformly by area. Near the light, area samples would carry
+    //huge weights (their density per solid angle goes to 0 with the distance squared).
+    Vec3 sample(const point3& origin, double time) const override {
+        double a = random_double();
+        double b = random_double();
+        if (rectangle) {
+            spherical_rectangle view(origin, Q, u, v);
+            if (view.solid_angle >= min_solid_angle)
+                return view.sample(a, b);
+        }
+        return Q + a * u + b * v - origin;
+    }
+
+    double pdf(const point3& origin, const Vec3& direction, double time) const override {
+        hit_record rec;
+        if (!quad::hit(Ray(origin, direction, time), interval(0.001, infinity), rec))
+            return 0;
+
+        if (rectangle) {
+            spherical_rectangle view(origin, Q, u, v);
+            if (view.solid_angle >= min_solid_angle)
+                return 1 / view.solid_angle;
+        }
+
+        //area density 1 / area turned into solid angle: distance^2 / (cosine * area)
+        double distance_squared = rec.t * rec.t * direction.length_squared();
+        double cosine = std::fabs(dot(direction, normal)) / direction.length();
+        return distance_squared / (cosine * area);
+    }
+
     private:
     point3 Q;
     Vec3 u;
@@ -73,6 +115,10 @@ class quad: public hittable {
     Bounding_Box bbox;
     double D;
     Vec3 w;
+    double area;
+    bool rectangle; //u and v orthogonal
+
+    static constexpr double min_solid_angle = 1e-4;
 
 };
 
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+
+//Random numbers for the renderer. Every thread draws from its own random_stream, a counter-based
+//generator: the n-th number of a stream is a hash of its key and n, so a stream costs nothing to
+//start and can be saved and picked up again (the wavefront queue keeps one per path).
+//The camera keys a fresh stream for every bounce of every sample by (seed, pixel, sample, bounce),
+//so an image depends only on the seed, never on threads, tiles or scheduling, and decisions at one
+//bounce do not shift when an earlier bounce takes more or fewer numbers.
+//The n-th number drawn at a bounce is always the same decision, so it is one dimension of the sample,
+//and a sampler (sampler.h) can hand out better placed numbers than independent ones.
+
+//splitmix64 finalizer: turns related keys (seed, pixel, sample index) into unrelated seeds
+inline uint64_t mix_seed(uint64_t key)
+{
+    key += 0x9e3779b97f4a7c15ull;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ull;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebull;
+    return key ^ (key >> 31);
+}
+
+struct random_stream;
+
+//Places the numbers of a sample's decisions, see sampler.h
+class sampler {
+    public:
+    virtual ~sampler() = default;
+
+    //Bounces past this draw independent numbers: after a few diffuse bounces paths are spread so
+    //widely that better placed numbers no longer lower the error, and they cost more to make.
+    int last_bounce = 3;
+
+    //number n drawn at stream.bounce by sample stream.index of pixel stream.x, stream.y, in [0, 1)
+    virtual double value(const random_stream& stream, uint32_t n) const = 0;
+
+    //name make_sampler knows it by, and any setting that changes its numbers; recorded in checkpoints
+    virtual std::string name() const = 0;
+};
+
+//One sample of one pixel: the key of its independent random numbers and what a sampler needs to know
+struct sample_id {
+    uint64_t key = 0;
+    uint64_t seed = 0;      //of the render
+    uint64_t pixel_key = 0; //of the pixel, the same for all its samples
+    int x = 0, y = 0;
+    uint32_t index = 0; //sample number within the pixel
+    const sampler* source = nullptr;
+};
+
+//SplitMix64 as a counter-based generator: number n of the stream is mix_seed(key + n * golden ratio).
+//Streams of a camera sample carry the sample, and draw from its sampler if it has one.
+struct random_stream {
+    uint64_t key = 0;
+    uint32_t counter = 0;
+    int bounce = 0;
+    sample_id sample;
+
+    //independent number n of the stream
+    double uniform(uint32_t n) const
+    {
+        //the top 53 bits, all a double holds
+        return (mix_seed(key + 0x9e3779b97f4a7c15ull * n) >> 11) * 0x1.0p-53;
+    }
+
+    double next_double()
+    {
+        uint32_t n = counter++;
+        return sample.source ? sample.source->value(*this, n) : uniform(n);
+    }
+};
+
+//key of the random numbers of one sample of one pixel
+inline uint64_t sample_key(uint64_t seed, uint64_t pixel, uint64_t sample)
+{
+    return mix_seed(seed ^ mix_seed(pixel ^ mix_seed(sample)));
+}
+
+inline uint64_t pixel_key(uint64_t seed, uint64_t pixel)
+{
+    return mix_seed(seed ^ mix_seed(pixel));
+}
+
+//Stream of one bounce of a sample: bounce 0 makes the camera ray, bounce k + 1 scatters at the k-th hit.
+//Each stream also serves the hit test of the ray it makes (volumes draw while being hit).
+//Negative bounces are side streams of independent numbers.
+inline random_stream bounce_stream(const sample_id& sample, int bounce)
+{
+    random_stream stream{ mix_seed(sample.key ^ uint64_t(bounce)), 0, bounce, sample };
+    if (bounce < 0 || (sample.source && bounce > sample.source->last_bounce))
+        stream.sample.source = nullptr;
+    return stream;
+}
+
+//this thread's current stream, seeded from the system until random_seed or the camera sets it
+inline random_stream& random_engine()
+{
+    thread_local static random_stream stream{ (uint64_t(std::random_device{}()) << 32) ^ std::random_device{}(), 0, 0, sample_id{} };
+    return stream;
+}
+
+//restarts this thread's random numbers from a known point, e.g. before building a random scene
+inline void random_seed(uint64_t seed)
+{
+    random_engine() = random_stream{ mix_seed(seed), 0, 0, sample_id{} };
+}
+
+//returns canonical {in [0,1)} random real.
+inline double random_double()
+{
+    return random_engine().next_double();
+}
+
+//returns random real in [min, max).
+inline double random_double(double min, double max)
+{
+    return min + random_double() * (max-min);
+}
+
+//returns a random int in [min, max].
+inline int random_int(int min, int max)
+{
+    return int(random_double(min, max+1));
+}
@@ -10,9 +10,15 @@ class Ray {
     Vec3 direction;
     double time;
 
+    //precomputed for the slab tests of bounding boxes and BVH nodes
+    Vec3 inv_direction;
+    int dir_is_neg[3];  //1 where the direction component is negative, picks the near slab plane and child order
+
 
     Ray() {}
-    Ray(const Vec3& origin, const Vec3& dir, double time) : origin(origin), direction(dir), time(time) {}    
+    Ray(const Vec3& origin, const Vec3& dir, double time) : origin(origin), direction(dir), time(time),
+        inv_direction(1.0 / dir.x, 1.0 / dir.y, 1.0 / dir.z),
+        dir_is_neg{ inv_direction.x < 0, inv_direction.y < 0, inv_direction.z < 0 } {}
     Ray(const Vec3& origin, const Vec3& dir) : Ray(origin, dir, 0) {}
 
 
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "utility.h"
+
+#include <cstdint>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+//A group of up to 16 coherent rays (e.g. the primary rays of a 4x4 pixel block) traced together.
+//Every lane keeps its own ray and search interval. The slab test data is kept in single precision
+//structure of arrays form, so one box can be tested against 4 lanes per SSE instruction.
+struct ray_packet {
+    static constexpr int max_size = 16;
+
+    int size = 0;
+    Ray rays[max_size];
+    interval ray_t[max_size];   //lowered to the closest hit found so far
+
+    alignas(16) float origin[3][max_size];
+    alignas(16) float inv_dir[3][max_size];
+    alignas(16) float t_min[max_size];
+    alignas(16) float t_max[max_size];
+    alignas(16) int32_t dir_is_neg[3][max_size];   //all bits set for a negative direction, so it works as an SSE mask
+
+    //adds a ray as the next lane. Returns the lane index.
+    int add(const Ray& r, interval search) {
+        int lane = size++;
+        rays[lane] = r;
+        for (int axis = 0; axis < 3; axis++) {
+            origin[axis][lane] = float(r.origin[axis]);
+            inv_dir[axis][lane] = float(r.inv_direction[axis]);
+            dir_is_neg[axis][lane] = inv_dir[axis][lane] < 0 ? -1 : 0;
+        }
+        ray_t[lane] = search;
+        t_min[lane] = float(search.min);
+        t_max[lane] = round_up(search.max);
+        return lane;
+    }
+
+    //mask with a bit set for every lane in use
+    uint32_t all() const { return (1u << size) - 1; }
+
+    //records a closer hit for the lane, so later box tests cull by it
+    void set_closest(int lane, double t) {
+        ray_t[lane].max = t;
+        t_max[lane] = round_up(t);
+    }
+
+    //true when every lane in active travels in the same octant, so a single near-first
+    //child order suits the whole packet
+    bool coherent(uint32_t active) const {
+        for (int axis = 0; axis < 3; axis++) {
+            int negative = 0, count = 0;
+            for (int lane = 0; lane < size; lane++) {
+                if (!(active & (1u << lane)))
+                    continue;
+                count++;
+                negative += dir_is_neg[axis][lane] != 0;
+            }
+            if (negative != 0 && negative != count)
+                return false;
+        }
+        return true;
+    }
+
+    private:
+    //a float limit never below the double one, so the box tests stay conservative
+    static float round_up(double value) {
+        float f = float(value);
+        return (double(f) < value) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+};
+
+//widens the far distance so float rounding in the slab test cannot miss a box a lane grazes
+const float ray_packet_far_scale = 1.0f + 2.0f * 3.0f * std::numeric_limits<float>::epsilon();
+
+//Tests one box (bounds[min/max][axis]) against the active lanes of a packet.
+//Returns the mask of active lanes whose current interval overlaps the box.
+inline uint32_t ray_packet_hit_box(const float bounds[2][3], const ray_packet& packet, uint32_t active)
+{
+    uint32_t mask = 0;
+
+#if defined(__SSE__) || defined(_M_X64)
+    const __m128 far_scale = _mm_set1_ps(ray_packet_far_scale);
+
+    //4 lanes per step, skipping groups with no active lane
+    for (int group = 0; group < packet.size; group += 4) {
+        if (!((active >> group) & 0xf))
+            continue;
+
+        __m128 lane_min = _mm_load_ps(packet.t_min + group);
+        __m128 lane_max = _mm_load_ps(packet.t_max + group);
+
+        for (int axis = 0; axis < 3; axis++) {
+            __m128 box_min = _mm_set1_ps(bounds[0][axis]);
+            __m128 box_max = _mm_set1_ps(bounds[1][axis]);
+            __m128 negative = _mm_castsi128_ps(_mm_load_si128((const __m128i*)(packet.dir_is_neg[axis] + group)));
+
+            //per lane, the near plane is the max corner for a negative direction
+            __m128 near_plane = _mm_or_ps(_mm_and_ps(negative, box_max), _mm_andnot_ps(negative, box_min));
+            __m128 far_plane = _mm_or_ps(_mm_and_ps(negative, box_min), _mm_andnot_ps(negative, box_max));
+
+            __m128 origin = _mm_load_ps(packet.origin[axis] + group);
+            __m128 inv_dir = _mm_load_ps(packet.inv_dir[axis] + group);
+            __m128 near = _mm_mul_ps(_mm_sub_ps(near_plane, origin), inv_dir);
+            __m128 far = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(far_plane, origin), inv_dir), far_scale);
+
+            //max/min return their second operand when the first is NaN
+            lane_min = _mm_max_ps(near, lane_min);
+            lane_max = _mm_min_ps(far, lane_max);
+        }
+
+        mask |= uint32_t(_mm_movemask_ps(_mm_cmple_ps(lane_min, lane_max))) << group;
+    }
+#else
+    for (int lane = 0; lane < packet.size; lane++) {
+        float lane_min = packet.t_min[lane];
+        float lane_max = packet.t_max[lane];
+        for (int axis = 0; axis < 3; axis++) {
+            int neg = packet.dir_is_neg[axis][lane] != 0;
+            float near = (bounds[neg][axis] - packet.origin[axis][lane]) * packet.inv_dir[axis][lane];
+            float far = (bounds[1 - neg][axis] - packet.origin[axis][lane]) * packet.inv_dir[axis][lane] * ray_packet_far_scale;
+            //written so a NaN from 0 * infinity leaves the interval untouched
+            if (near > lane_min) lane_min = near;
+            if (far < lane_max) lane_max = far;
+        }
+        if (lane_min <= lane_max)
+            mask |= 1u << lane;
+    }
+#endif
+
+    return mask & active;
+}
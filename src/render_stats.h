@@ -0,0 +1,126 @@
+#pragma once
+
+#include <omp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Render progress and per-thread telemetry. Render threads only add to their own relaxed counters,
+//once per tile. A reporter thread wakes every interval seconds, sums the counters and prints
+//progress, throughput, ETA and load balance: a status line on std::clog, or one JSON object
+//per line on std::cerr for job schedulers to scrape.
+class Render_Stats {
+    public:
+    Render_Stats(int thread_count, long long total_samples, bool json = false, double interval = 0.5)
+    : threads(std::max(1, thread_count)), total_samples(std::max(1LL, total_samples)), json(json), interval(interval) {}
+
+    ~Render_Stats() { stop(); }
+
+    void start() {
+        start_time = omp_get_wtime();
+        running = true;
+        reporter = std::thread([this] {
+            std::unique_lock<std::mutex> guard(reporter_lock);
+            while (!reporter_wake.wait_for(guard, std::chrono::duration<double>(interval), [this] { return !running; }))
+                report("progress");
+        });
+    }
+
+    //stops the reporter and prints the final totals
+    void stop() {
+        if (!reporter.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> guard(reporter_lock);
+            running = false;
+        }
+        reporter_wake.notify_all();
+        reporter.join();
+        end_time = omp_get_wtime();
+        report("done");
+    }
+
+    //called by a render thread after each tile with the pixel samples it took
+    void record_tile(int thread, long long samples, long long rays, double busy_seconds) {
+        thread_counters& counters = threads[thread];
+        counters.samples.fetch_add(samples, std::memory_order_relaxed);
+        counters.rays.fetch_add(rays, std::memory_order_relaxed);
+        counters.busy_ns.fetch_add(uint64_t(busy_seconds * 1e9), std::memory_order_relaxed);
+    }
+
+    double elapsed() const { return (running || end_time == 0 ? omp_get_wtime() : end_time) - start_time; }
+
+    private:
+    //one cache line per thread, so counters of different threads never share a line
+    struct alignas(64) thread_counters {
+        std::atomic<long long> samples{0};
+        std::atomic<long long> rays{0};
+        std::atomic<uint64_t> busy_ns{0};
+    };
+
+    std::vector<thread_counters> threads;
+    long long total_samples;
+    bool json;
+    double interval;
+
+    double start_time = 0;
+    double end_time = 0;
+    std::atomic<bool> running{false};
+    std::thread reporter;
+    std::mutex reporter_lock;
+    std::condition_variable reporter_wake;
+
+    void report(const char* event) const {
+        double seconds = std::max(elapsed(), 1e-9);
+
+        long long samples = 0, rays = 0;
+        double busiest = 0, total_busy = 0;
+        std::vector<double> utilization(threads.size());
+        for (size_t i = 0; i < threads.size(); i++) {
+            samples += threads[i].samples.load(std::memory_order_relaxed);
+            rays += threads[i].rays.load(std::memory_order_relaxed);
+            double busy = threads[i].busy_ns.load(std::memory_order_relaxed) * 1e-9;
+            utilization[i] = busy / seconds;
+            busiest = std::max(busiest, busy);
+            total_busy += busy;
+        }
+
+        double fraction = double(samples) / total_samples;
+        double samples_per_second = samples / seconds;
+        double rays_per_second = rays / seconds;
+        double eta = fraction > 0 ? seconds * (1 - fraction) / fraction : -1;
+        //busiest thread's work over the average, 1 when perfectly balanced
+        double imbalance = total_busy > 0 ? busiest * threads.size() / total_busy : 1;
+
+        std::ostringstream line;
+        if (json) {
+            line << "{\"event\":\"" << event << "\",\"elapsed_s\":" << seconds << ",\"samples\":" << samples
+                 << ",\"total_samples\":" << total_samples << ",\"fraction\":" << fraction
+                 << ",\"samples_per_s\":" << samples_per_second << ",\"rays\":" << rays << ",\"rays_per_s\":" << rays_per_second
+                 << ",\"eta_s\":" << eta << ",\"imbalance\":" << imbalance << ",\"thread_utilization\":[";
+            for (size_t i = 0; i < utilization.size(); i++)
+                line << (i ? "," : "") << utilization[i];
+            line << "]}\n";
+            std::cerr << line.str() << std::flush;
+            return;
+        }
+
+        line.precision(3);
+        line << "\r" << 100 * fraction << "% | " << rays_per_second / 1e6 << " Mrays/s | "
+             << samples_per_second / 1e6 << " Msamples/s | ";
+        if (std::string(event) == "done")
+            line << seconds << " s | imbalance " << imbalance << "          \n";
+        else
+            line << "ETA " << eta << " s | imbalance " << imbalance << "     ";
+        std::clog << line.str() << std::flush;
+    }
+};
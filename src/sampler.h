@@ -0,0 +1,276 @@
+#pragma once
+
+#include "utility.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <string>
+#include <vector>
+
+//Samplers place the numbers of a sample's decisions. Every number a sample draws is a dimension,
+//numbered by its bounce and by how many numbers that bounce drew before it (see random.h).
+//Dimensions are treated in pairs, since most decisions (pixel position, lens position, scatter
+//direction) take two numbers. A sampler sees the sample number within the pixel, so the samples of
+//one pixel can cover each dimension more evenly than independent numbers, while different pixels
+//and dimensions are scrambled apart.
+
+//float in [0, 1) from 32 bits
+inline double bits_to_unit(uint32_t bits) { return bits * 0x1.0p-32; }
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+#if defined(__GNUC__)
+    return __builtin_bswap32(x);
+#else
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+#endif
+}
+
+//Owen scrambling by hashing, from Burley, "Practical Hash-based Owen Scrambling" (2020):
+//flips each bit depending only on the bits above it, the same as a random nested uniform scramble.
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+//first two dimensions of the Sobol sequence, as 32 bit fractions
+inline uint32_t sobol_2d(uint32_t index, int dimension) {
+    if (dimension == 0)
+        return reverse_bits(index);
+
+    //the second dimension XORs one direction number per set bit of index; tables do it a byte at a time
+    static const std::array<std::array<uint32_t, 256>, 4> byte_directions = [] {
+        std::array<std::array<uint32_t, 256>, 4> tables{};
+        uint32_t direction = 1u << 31;
+        for (int bit = 0; bit < 32; bit++, direction ^= direction >> 1) {
+            for (uint32_t byte = 0; byte < 256; byte++) {
+                if (byte & (1u << (bit % 8)))
+                    tables[bit / 8][byte] ^= direction;
+            }
+        }
+        return tables;
+    }();
+    return byte_directions[0][index & 0xff] ^ byte_directions[1][(index >> 8) & 0xff] ^
+           byte_directions[2][(index >> 16) & 0xff] ^ byte_directions[3][index >> 24];
+}
+
+//Random permutation of [0, size) given by seed, from Kensler, "Correlated Multi-Jittered Sampling" (2013)
+inline uint32_t permute(uint32_t i, uint32_t size, uint32_t seed) {
+    uint32_t w = size - 1;
+    w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+    do {
+        i ^= seed; i *= 0xe170893du; i ^= seed >> 16;
+        i ^= (i & w) >> 4; i ^= seed >> 8; i *= 0x0929eb3fu;
+        i ^= seed >> 23; i ^= (i & w) >> 1; i *= 1 | seed >> 27;
+        i *= 0x6935fa69u; i ^= (i & w) >> 11; i *= 0x74dcb303u;
+        i ^= (i & w) >> 2; i *= 0x9e501cc3u; i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu; i &= w; i ^= i >> 5;
+    } while (i >= size);
+    return (i + seed) % size;
+}
+
+//key of the scrambles of one pair of dimensions of a pixel (pixel_key) or of the whole image (seed)
+inline uint64_t pair_scramble(uint64_t key, int bounce, uint32_t n) {
+    return mix_seed(key + 0x9e3779b97f4a7c15ull * ((uint64_t(uint32_t(bounce)) << 32) | (n / 2)));
+}
+
+//Independent uniform numbers, the renderer's default.
+class independent_sampler : public sampler {
+    public:
+    double value(const random_stream& stream, uint32_t n) const override { return stream.uniform(n); }
+
+    std::string name() const override { return "independent"; }
+};
+
+//Every dimension of the first strata samples of a pixel takes one number from each of strata equal
+//intervals, in an order shuffled per pixel and dimension (Latin hypercube), and so on for each further
+//run of strata samples. Best when strata is the number of samples per pixel.
+class stratified_sampler : public sampler {
+    public:
+    stratified_sampler(int strata) : strata(uint32_t(std::max(1, strata))) {}
+
+    double value(const random_stream& stream, uint32_t n) const override {
+        uint32_t run = stream.sample.index / strata;
+        uint64_t order = mix_seed(pair_scramble(stream.sample.pixel_key, stream.bounce, n) ^ mix_seed(uint64_t(run) << 1 | (n & 1)));
+        uint32_t stratum = permute(stream.sample.index % strata, strata, uint32_t(order));
+        return std::min((stratum + stream.uniform(n)) / strata, 0x1.fffffffffffffp-1);
+    }
+
+    std::string name() const override { return "stratified " + std::to_string(strata); }
+
+    private:
+    uint32_t strata;
+};
+
+//The Halton sequence, one prime base per dimension, Owen scrambled per pixel and dimension: each digit
+//is permuted by a permutation that depends on the digits above it. Unscrambled, pairs of high bases
+//start out on a few lines. Bases still grow with the dimension, so each bounce takes
+//bounce_dimensions of them and the rest are independent.
+class halton_sampler : public sampler {
+    public:
+    static constexpr int bounce_dimensions = 6;
+
+    std::string name() const override { return "halton"; }
+
+    double value(const random_stream& stream, uint32_t n) const override {
+        static constexpr int primes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71, 73, 79, 83, 89,
+                                          97, 101, 103, 107, 109, 113, 127, 131, 137, 139, 149, 151, 157, 163, 167, 173, 179, 181,
+                                          191, 193, 197, 199, 211, 223, 227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281 };
+        int dimension = stream.bounce * bounce_dimensions + int(n);
+        if (int(n) >= bounce_dimensions || dimension >= int(std::size(primes)))
+            return stream.uniform(n);
+
+        uint32_t base = uint32_t(primes[dimension]);
+        uint64_t digits_above = mix_seed(stream.sample.pixel_key ^ uint64_t(dimension));
+        double inverse_base = 1.0 / base, digit_value = inverse_base, result = 0;
+        for (uint32_t index = stream.sample.index; index > 0; index /= base) {
+            uint32_t digit = index % base;
+            result += permute(digit, base, uint32_t(digits_above)) * digit_value;
+            digits_above = mix_seed(digits_above ^ digit);
+            digit_value *= inverse_base;
+        }
+        //Past the index's digits, every scrambled zero digit is uniform and independent, since no two
+        //indices share all their digits, so the rest of the value is one uniform number.
+        result += bits_to_unit(uint32_t(digits_above)) * digit_value * base;
+        return std::min(result, 0x1.fffffffffffffp-1);
+    }
+};
+
+//Padded Owen-scrambled Sobol points, as in Burley (2020): each pair of dimensions is a 2D Sobol set
+//with its own shuffle of the sample order and its own Owen scramble, per pixel. Every power of two
+//prefix of a pixel's samples is stratified in each pair, to as many strata as samples.
+class sobol_sampler : public sampler {
+    public:
+    std::string name() const override { return "sobol"; }
+
+    double value(const random_stream& stream, uint32_t n) const override {
+        return bits_to_unit(sobol_bits(pair_scramble(stream.sample.pixel_key, stream.bounce, n), stream.sample.index, n));
+    }
+
+    //dimension n & 1 of sample index of the pair scrambled by key
+    static uint32_t sobol_bits(uint64_t key, uint32_t index, uint32_t n) {
+        uint32_t shuffled = nested_uniform_scramble(index, uint32_t(key));
+        return nested_uniform_scramble(sobol_2d(shuffled, n & 1), uint32_t(key >> 32) ^ (n & 1 ? 0x9e3779b9u : 0));
+    }
+};
+
+//64 x 64 blue noise mask: the ranks of a void and cluster dither array (Ulichney 1993) as values in (0, 1).
+//Neighbouring values differ as much as possible, so shifting each pixel's numbers by the mask leaves
+//the error between pixels as high frequency noise, which looks finer at the same magnitude.
+inline const std::vector<float>& blue_noise_mask() {
+    static const std::vector<float> mask = [] {
+        constexpr int size = 64, count = size * size;
+        const double sigma = 1.9;
+
+        //energy one point puts on each offset of the torus
+        std::vector<double> kernel(count);
+        for (int dy = 0; dy < size; dy++) {
+            for (int dx = 0; dx < size; dx++) {
+                int x = std::min(dx, size - dx), y = std::min(dy, size - dy);
+                kernel[dy * size + dx] = std::exp(-(x * x + y * y) / (2 * sigma * sigma));
+            }
+        }
+        std::vector<double> energy(count, 0);
+        std::vector<char> on(count, 0);
+        auto splat = [&](int p, double sign) {
+            on[p] = sign > 0;
+            int px = p % size, py = p / size;
+            for (int y = 0; y < size; y++)
+                for (int x = 0; x < size; x++)
+                    energy[y * size + x] += sign * kernel[((y - py) & (size - 1)) * size + ((x - px) & (size - 1))];
+        };
+        //tightest cluster: the set point with the most energy; largest void: the empty one with the least
+        auto extreme = [&](bool set) {
+            int best = -1;
+            for (int p = 0; p < count; p++) {
+                if (on[p] == set && (best < 0 || (set ? energy[p] > energy[best] : energy[p] < energy[best])))
+                    best = p;
+            }
+            return best;
+        };
+
+        //a tenth of the points at random, then spread out by moving clusters into voids until stable
+        int initial = 0;
+        for (uint64_t k = 0; initial < count / 10; k++) {
+            int p = int(mix_seed(k) % count);
+            if (!on[p]) {
+                splat(p, 1);
+                initial++;
+            }
+        }
+        for (int moves = 0; moves < count; moves++) {
+            int cluster = extreme(true);
+            splat(cluster, -1);
+            int largest_void = extreme(false);
+            splat(largest_void, 1);
+            if (largest_void == cluster)
+                break;
+        }
+
+        //rank the initial points by removing clusters first, then fill the voids in order
+        std::vector<int> rank(count);
+        std::vector<double> initial_energy = energy;
+        std::vector<char> initial_on = on;
+        for (int ones = initial; ones > 0; ones--) {
+            int cluster = extreme(true);
+            rank[cluster] = ones - 1;
+            splat(cluster, -1);
+        }
+        energy = initial_energy;
+        on = initial_on;
+        for (int filled = initial; filled < count; filled++) {
+            int largest_void = extreme(false);
+            rank[largest_void] = filled;
+            splat(largest_void, 1);
+        }
+
+        std::vector<float> values(count);
+        for (int p = 0; p < count; p++)
+            values[p] = (rank[p] + 0.5f) / count;
+        return values;
+    }();
+    return mask;
+}
+
+//Blue-noise dithered sampling (Georgiev and Fajardo 2016): every pixel takes the same padded Sobol points,
+//shifted per pixel (Cranley-Patterson rotation) by a blue noise mask, offset differently for each dimension.
+//Each pixel still has well stratified samples, and the remaining error is blue noise across the image.
+class blue_noise_sampler : public sampler {
+    public:
+    std::string name() const override { return "bluenoise"; }
+
+    double value(const random_stream& stream, uint32_t n) const override {
+        uint64_t key = pair_scramble(stream.sample.seed, stream.bounce, n);
+        double point = bits_to_unit(sobol_sampler::sobol_bits(key, stream.sample.index, n));
+
+        uint64_t offset = mix_seed(key ^ (n & 1));
+        int x = (stream.sample.x + int(offset & 63)) & 63, y = (stream.sample.y + int((offset >> 6) & 63)) & 63;
+        double shifted = point + blue_noise_mask()[y * 64 + x];
+        return shifted >= 1 ? shifted - 1 : shifted;
+    }
+};
+
+//sampler by name: independent, stratified, halton, sobol or bluenoise; nullptr for other names.
+//samples_per_pixel sets the strata of the stratified sampler.
+inline shared_ptr<sampler> make_sampler(const std::string& name, int samples_per_pixel) {
+    if (name == "independent")
+        return make_shared<independent_sampler>();
+    if (name == "stratified")
+        return make_shared<stratified_sampler>(samples_per_pixel);
+    if (name == "halton")
+        return make_shared<halton_sampler>();
+    if (name == "sobol")
+        return make_shared<sobol_sampler>();
+    if (name == "bluenoise")
+        return make_shared<blue_noise_sampler>();
+    return nullptr;
+}
@@ -5,6 +5,7 @@
 #include <vector>
 #include <algorithm>
 #include "hittable.h"
+#include "material.h"
 
 //std::fmax() & std::fmin() are C++ standard functions
 
@@ -69,6 +70,7 @@ class Sphere : public hittable
         Vec3 outward_normal = (rec.collision - current_center) / radius;
         rec.set_face_normal(r, outward_normal);
         rec.mat = mat;
+        rec.object = this;
         //outward_normal = p relative to the center of the sphere.
         set_uv_coords_sphere(outward_normal, rec.u, rec.v);
 
@@ -85,6 +87,51 @@ class Sphere : public hittable
     }
 
     Bounding_Box bounding_box() const override { return bbox;}
+
+    void collect_lights(std::vector<const hittable*>& lights) const override {
+        if (mat->is_emissive())
+            lights.push_back(this);
+    }
+
+    //Uniform within the cone of directions the sphere fills as seen from origin, which wastes no samples
+    //on the far side. From inside, uniform over the surface.
+    Vec3 sample(const point3& origin, double time) const override {
+        Vec3 to_center = cur_pos(time) - origin;
+        double distance_squared = to_center.length_squared();
+        double u1 = random_double();
+        double u2 = random_double();
+        if (distance_squared <= radius * radius)
+            return cur_pos(time) + radius * warp_uniform_sphere(u1, u2).value - origin;
+
+        double cos_theta_max = std::sqrt(1 - radius * radius / distance_squared);
+        return onb(to_center / std::sqrt(distance_squared)).to_world(warp_uniform_cone(u1, u2, cos_theta_max).value);
+    }
+
+    double pdf(const point3& origin, const Vec3& direction, double time) const override {
+        hit_record rec;
+        if (!Sphere::hit(Ray(origin, direction, time), interval(0.001, infinity), rec))
+            return 0;
+
+        double distance_squared = (cur_pos(time) - origin).length_squared();
+        if (distance_squared > radius * radius)
+            return uniform_cone_pdf(std::sqrt(1 - radius * radius / distance_squared));
+
+        //area density 1 / (4 pi r^2) turned into solid angle
+        double cosine = std::fabs(dot(direction, rec.normal)) / direction.length();
+        return rec.t * rec.t * direction.length_squared() / (cosine * 4 * pi * radius * radius);
+    }
+
+    //moves the sphere, e.g. for the next animation frame. A moving sphere keeps its position function,
+    //now relative to the new center. Any BVH holding the sphere needs a refit afterwards.
+    void set_center(const point3& new_center) {
+        center = new_center;
+        if (pos_func == static_position)
+            bbox = Bounding_Box(center - Vec3(radius, radius, radius), center + Vec3(radius, radius, radius));
+        else
+            bbox = computeBoundingBoxForMovingSphere(pos_func, center, radius, 0.0, 1.0);
+    }
+
+    const point3& get_center() const { return center; }
     
     private:
 
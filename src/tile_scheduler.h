@@ -0,0 +1,135 @@
+#pragma once
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+//rectangle of pixels [x0, x1) x [y0, y1) rendered as one unit of work
+struct render_tile {
+    int x0, y0, x1, y1;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+    int pixel_count() const { return width() * height(); }
+};
+
+//interleaves the bits of x and y, so sorting by the code walks a Z-order (Morton) curve
+inline uint32_t morton_code(uint32_t x, uint32_t y) {
+    auto spread = [](uint32_t v) {
+        v &= 0xffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+//Cuts an image into tile_size x tile_size tiles (smaller at the right and bottom edges),
+//ordered along a Morton curve so tiles close in the list are close on screen.
+inline std::vector<render_tile> make_tiles(int image_width, int image_height, int tile_size) {
+    tile_size = std::max(1, tile_size);
+    int tiles_x = (image_width + tile_size - 1) / tile_size;
+    int tiles_y = (image_height + tile_size - 1) / tile_size;
+
+    std::vector<std::pair<uint32_t, render_tile>> coded;
+    coded.reserve(size_t(tiles_x) * tiles_y);
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            render_tile tile = { tx * tile_size, ty * tile_size,
+                                 std::min((tx + 1) * tile_size, image_width), std::min((ty + 1) * tile_size, image_height) };
+            coded.push_back({ morton_code(uint32_t(tx), uint32_t(ty)), tile });
+        }
+    }
+    std::stable_sort(coded.begin(), coded.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<render_tile> tiles;
+    tiles.reserve(coded.size());
+    for (const auto& entry : coded)
+        tiles.push_back(entry.second);
+    return tiles;
+}
+
+//Cuts the tiles down to the part of them inside region, dropping tiles outside it; the Morton order is kept.
+inline std::vector<render_tile> clip_tiles(const std::vector<render_tile>& tiles, const render_tile& region) {
+    std::vector<render_tile> clipped;
+    for (const render_tile& tile : tiles) {
+        render_tile part = { std::max(tile.x0, region.x0), std::max(tile.y0, region.y0),
+                             std::min(tile.x1, region.x1), std::min(tile.y1, region.y1) };
+        if (part.width() > 0 && part.height() > 0)
+            clipped.push_back(part);
+    }
+    return clipped;
+}
+
+//Hands out tiles to OpenMP threads. Every thread starts with its own deque holding a contiguous run
+//of the tile list and takes work from its front. A thread whose deque runs dry steals from the back
+//of another thread's deque, so the long runs of neighbouring tiles stay with their owner.
+class Tile_Scheduler {
+    public:
+    Tile_Scheduler(std::vector<render_tile> tiles) : tiles(std::move(tiles)) {}
+
+    //Calls render(tile, thread) for every tile, spread over thread_count threads (all available by default).
+    template <typename RenderFn>
+    void run(RenderFn render, int thread_count = 0) {
+        if (thread_count <= 0)
+            thread_count = omp_get_max_threads();
+        thread_count = std::max(1, std::min<int>(thread_count, int(tiles.size())));
+
+        std::vector<worker_queue> queues(thread_count);
+        for (int thread = 0; thread < thread_count; thread++) {
+            size_t first = tiles.size() * thread / thread_count;
+            size_t last = tiles.size() * (thread + 1) / thread_count;
+            for (size_t i = first; i < last; i++)
+                queues[thread].tiles.push_back(uint32_t(i));
+        }
+
+        #pragma omp parallel num_threads(thread_count) default(shared)
+        {
+            int thread = omp_get_thread_num();
+            uint32_t tile;
+            while (pop(queues, thread, tile) || steal(queues, thread, tile))
+                render(tiles[tile], thread);
+        }
+    }
+
+    size_t tile_count() const { return tiles.size(); }
+
+    private:
+    //one cache line per queue, so the owner and thieves of different queues do not share lines
+    struct alignas(64) worker_queue {
+        std::mutex lock;
+        std::deque<uint32_t> tiles;
+    };
+
+    std::vector<render_tile> tiles;
+
+    static bool pop(std::vector<worker_queue>& queues, int thread, uint32_t& tile) {
+        std::lock_guard<std::mutex> guard(queues[thread].lock);
+        if (queues[thread].tiles.empty())
+            return false;
+        tile = queues[thread].tiles.front();
+        queues[thread].tiles.pop_front();
+        return true;
+    }
+
+    //tiles are never added back, so finding every other queue empty means all work is handed out
+    static bool steal(std::vector<worker_queue>& queues, int thread, uint32_t& tile) {
+        int count = int(queues.size());
+        for (int offset = 1; offset < count; offset++) {
+            worker_queue& victim = queues[(thread + offset) % count];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (victim.tiles.empty())
+                continue;
+            tile = victim.tiles.back();
+            victim.tiles.pop_back();
+            return true;
+        }
+        return false;
+    }
+};
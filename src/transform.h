@@ -0,0 +1,121 @@
+#pragma once
+
+#include "utility.h"
+#include "bounding_box.h"
+
+//Affine transform stored as the top three rows of a 4x4 matrix: a 3x3 linear part and a translation column.
+//Points take the translation, vectors only the linear part.
+class Affine_Transform {
+    public:
+    double m[3][4];
+
+    //identity
+    Affine_Transform() {
+        for (int row = 0; row < 3; row++)
+            for (int col = 0; col < 4; col++)
+                m[row][col] = (row == col) ? 1 : 0;
+    }
+
+    static Affine_Transform translation(const Vec3& offset) {
+        Affine_Transform t;
+        for (int row = 0; row < 3; row++)
+            t.m[row][3] = offset[row];
+        return t;
+    }
+
+    static Affine_Transform scaling(const Vec3& factors) {
+        Affine_Transform t;
+        for (int row = 0; row < 3; row++)
+            t.m[row][row] = factors[row];
+        return t;
+    }
+
+    static Affine_Transform scaling(double factor) { return scaling(Vec3(factor, factor, factor)); }
+
+    //rotation by angle degrees counterclockwise about axis (Rodrigues' formula)
+    static Affine_Transform rotation(const Vec3& axis, double degrees) {
+        Vec3 k = unit_vector(axis);
+        double radians = degrees_to_radians(degrees);
+        double c = std::cos(radians), s = std::sin(radians), t = 1 - c;
+
+        Affine_Transform r;
+        r.m[0][0] = t*k.x*k.x + c;      r.m[0][1] = t*k.x*k.y - s*k.z;  r.m[0][2] = t*k.x*k.z + s*k.y;
+        r.m[1][0] = t*k.x*k.y + s*k.z;  r.m[1][1] = t*k.y*k.y + c;      r.m[1][2] = t*k.y*k.z - s*k.x;
+        r.m[2][0] = t*k.x*k.z - s*k.y;  r.m[2][1] = t*k.y*k.z + s*k.x;  r.m[2][2] = t*k.z*k.z + c;
+        return r;
+    }
+
+    Vec3 point(const Vec3& p) const {
+        return Vec3(m[0][0]*p.x + m[0][1]*p.y + m[0][2]*p.z + m[0][3],
+                    m[1][0]*p.x + m[1][1]*p.y + m[1][2]*p.z + m[1][3],
+                    m[2][0]*p.x + m[2][1]*p.y + m[2][2]*p.z + m[2][3]);
+    }
+
+    Vec3 vector(const Vec3& v) const {
+        return Vec3(m[0][0]*v.x + m[0][1]*v.y + m[0][2]*v.z,
+                    m[1][0]*v.x + m[1][1]*v.y + m[1][2]*v.z,
+                    m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z);
+    }
+
+    //multiplies v by the transpose of the linear part. Called on the inverse transform this maps normals.
+    Vec3 transpose_vector(const Vec3& v) const {
+        return Vec3(m[0][0]*v.x + m[1][0]*v.y + m[2][0]*v.z,
+                    m[0][1]*v.x + m[1][1]*v.y + m[2][1]*v.z,
+                    m[0][2]*v.x + m[1][2]*v.y + m[2][2]*v.z);
+    }
+
+    //inverse of a transform with a non-singular linear part
+    Affine_Transform inverse() const {
+        //cofactors of the linear part, transposed
+        Affine_Transform inv;
+        inv.m[0][0] = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+        inv.m[0][1] = m[0][2]*m[2][1] - m[0][1]*m[2][2];
+        inv.m[0][2] = m[0][1]*m[1][2] - m[0][2]*m[1][1];
+        inv.m[1][0] = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+        inv.m[1][1] = m[0][0]*m[2][2] - m[0][2]*m[2][0];
+        inv.m[1][2] = m[0][2]*m[1][0] - m[0][0]*m[1][2];
+        inv.m[2][0] = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+        inv.m[2][1] = m[0][1]*m[2][0] - m[0][0]*m[2][1];
+        inv.m[2][2] = m[0][0]*m[1][1] - m[0][1]*m[1][0];
+
+        double det = m[0][0]*inv.m[0][0] + m[0][1]*inv.m[1][0] + m[0][2]*inv.m[2][0];
+        for (int row = 0; row < 3; row++)
+            for (int col = 0; col < 3; col++)
+                inv.m[row][col] /= det;
+
+        //undo the translation after the inverse linear part
+        Vec3 offset = inv.vector(Vec3(m[0][3], m[1][3], m[2][3]));
+        for (int row = 0; row < 3; row++)
+            inv.m[row][3] = -offset[row];
+        return inv;
+    }
+
+    //box enclosing the transformed box (Arvo's method: each output extent is a sum of per-axis extremes)
+    Bounding_Box box(const Bounding_Box& b) const {
+        double lo[3], hi[3];
+        for (int row = 0; row < 3; row++) {
+            lo[row] = hi[row] = m[row][3];
+            for (int col = 0; col < 3; col++) {
+                const interval& extent = b.axis_interval(col);
+                double a = m[row][col] * extent.min;
+                double c = m[row][col] * extent.max;
+                lo[row] += std::fmin(a, c);
+                hi[row] += std::fmax(a, c);
+            }
+        }
+        return Bounding_Box(interval(lo[0], hi[0]), interval(lo[1], hi[1]), interval(lo[2], hi[2]));
+    }
+};
+
+//applies b first, then a
+inline Affine_Transform operator*(const Affine_Transform& a, const Affine_Transform& b) {
+    Affine_Transform product;
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 4; col++) {
+            product.m[row][col] = a.m[row][0]*b.m[0][col] + a.m[row][1]*b.m[1][col] + a.m[row][2]*b.m[2][col];
+            if (col == 3)
+                product.m[row][col] += a.m[row][3];
+        }
+    }
+    return product;
+}
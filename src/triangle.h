@@ -2,8 +2,88 @@
 
 #include "utility.h"
 #include "hittable.h"
+#include "hittable_list.h"
 #include <vector>
 
+//branch-free axis lookup for the triangle kernel (Vec3::operator[] goes through a switch)
+inline double triangle_axis(const Vec3& v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+//Per-ray setup of the watertight triangle test (Woop, Benthin and Wald 2013).
+//The ray is permuted so z is its dominant axis and sheared to point along +z, which turns the
+//intersection into a 2D edge-function test. Build it once and reuse it for every triangle the ray is tested against.
+struct triangle_ray {
+    point3 origin;
+    int kx, ky, kz;         //permutation of the axes, kz = dominant direction axis
+    double sx, sy, sz;      //shear constants
+
+    triangle_ray() {}
+    triangle_ray(const Ray& r) : origin(r.origin) {
+        const Vec3& d = r.direction;
+        double ax = std::fabs(d.x), ay = std::fabs(d.y), az = std::fabs(d.z);
+        kz = (ax > ay) ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        //keep the winding of the triangles unchanged
+        if (triangle_axis(d, kz) < 0) std::swap(kx, ky);
+
+        sx = triangle_axis(d, kx) / triangle_axis(d, kz);
+        sy = triangle_axis(d, ky) / triangle_axis(d, kz);
+        sz = 1.0 / triangle_axis(d, kz);
+    }
+};
+
+//Watertight intersection of a prepared ray with the triangle abc. Rays through a shared edge or vertex
+//always hit at least one of the triangles meeting there, and grazing rays are not rejected by a tolerance.
+//On a hit inside ray_t, sets the hit time and the barycentric coordinates of the hit point
+//(alpha for a, beta for b, upsilon for c), computed once so shading can reuse them.
+inline bool triangle_intersect(const triangle_ray& ray, const interval& ray_t, const point3& a, const point3& b, const point3& c,
+                               double& t, double& alpha, double& beta, double& upsilon)
+{
+    //vertices relative to the ray origin
+    const Vec3 A = a - ray.origin;
+    const Vec3 B = b - ray.origin;
+    const Vec3 C = c - ray.origin;
+
+    //shear and scale the vertices into ray space
+    const double Ax = triangle_axis(A, ray.kx) - ray.sx*triangle_axis(A, ray.kz);
+    const double Ay = triangle_axis(A, ray.ky) - ray.sy*triangle_axis(A, ray.kz);
+    const double Bx = triangle_axis(B, ray.kx) - ray.sx*triangle_axis(B, ray.kz);
+    const double By = triangle_axis(B, ray.ky) - ray.sy*triangle_axis(B, ray.kz);
+    const double Cx = triangle_axis(C, ray.kx) - ray.sx*triangle_axis(C, ray.kz);
+    const double Cy = triangle_axis(C, ray.ky) - ray.sy*triangle_axis(C, ray.kz);
+
+    //scaled barycentric coordinates from the 2D edge functions
+    const double U = Cx*By - Cy*Bx;
+    const double V = Ax*Cy - Ay*Cx;
+    const double W = Bx*Ay - By*Ax;
+
+    //the ray passes outside an edge when the signs disagree
+    if ((U < 0 || V < 0 || W < 0) && (U > 0 || V > 0 || W > 0))
+        return false;
+
+    //ray lies in the plane of the triangle (or the triangle is degenerate)
+    const double det = U + V + W;
+    if (det == 0)
+        return false;
+
+    const double Az = ray.sz*triangle_axis(A, ray.kz);
+    const double Bz = ray.sz*triangle_axis(B, ray.kz);
+    const double Cz = ray.sz*triangle_axis(C, ray.kz);
+
+    const double inv_det = 1.0 / det;
+    const double collision_time = (U*Az + V*Bz + W*Cz) * inv_det;
+    if (!ray_t.contains(collision_time))
+        return false;
+
+    t = collision_time;
+    alpha = U * inv_det;
+    beta = V * inv_det;
+    upsilon = W * inv_det;
+    return true;
+}
+
 class Triangle : public hittable
 {
     public:
@@ -21,40 +101,18 @@ class Triangle : public hittable
         );
     }
 
-    //check if hit with plane, if yes then calculate barycentric coords and check if pos, if yes then hit at intersection with plane (store in rec)
+    //intersect with the watertight kernel, then shade from the barycentric coords it returns (store in rec)
     bool hit(const Ray& r, interval ray_t, hit_record& rec) const override
     {
-        //construct plane
-        //a = point, normal = normal of plane
-
-        //check for ray moving along the plane
-        if (cmpfloat(dot(r.direction, normal), 0))
-        {
-            return false;
-        }
-        
-        // find intersection with plane
-        // t = (dot((plane_point - ray_origin), plane_normal) / dot(ray_direction, plane_normal))
-        auto collision_time = dot(a - r.origin, normal) / dot(r.direction, normal);
-        if (!ray_t.contains(collision_time))
+        double collision_time, alpha, beta, upsilon;
+        if (!triangle_intersect(triangle_ray(r), ray_t, a, b, c, collision_time, alpha, beta, upsilon))
             return false;
-        auto p = r.at(collision_time);
-
-        // Calculate barycentric coordinates
-        auto alpha = dot(normal, cross(c - b, p - b)) / normal.length_squared();
-        auto beta = dot(normal, cross(a - c, p - c)) / normal.length_squared();
-        auto upsilon = dot(normal, cross(b - a, p - a)) / normal.length_squared();
-
-        //if any negative barycentric coord, then misses the triangle.
-        if (alpha < 0 || beta < 0 || upsilon < 0)
-        {
-            return false;
-        }
 
         rec.t = collision_time;
-        rec.collision = p;
+        rec.collision = r.at(collision_time);
         rec.set_face_normal(r, unit_vector(normal));
         rec.mat = mat;
+        rec.object = this;
         set_uv_coords_triangle(rec.u, rec.v, alpha, beta, upsilon);
 
         return true;
@@ -104,41 +162,21 @@ class Smooth_Triangle : public hittable
         );
     }
 
-    //check if hit with plane, if yes then calculate barycentric coords and check if pos, if yes then hit at intersection with plane (store in rec)
+    //intersect with the watertight kernel, then shade from the barycentric coords it returns (store in rec)
     bool hit(const Ray& r, interval ray_t, hit_record& rec) const override
     {
-
-        //check for ray moving along the plane
-        if (cmpfloat(dot(r.direction, normal), 0))
-        {
-            return false;
-        }
-        
-        // find intersection with plane
-        // t = (dot((plane_point - ray_origin), plane_normal) / dot(ray_direction, plane_normal))
-        auto collision_time = dot(a - r.origin, normal) / dot(r.direction, normal);
-        if (!ray_t.contains(collision_time))
-            return false;
-        auto p = r.at(collision_time);
-
-        // Calculate barycentric coordinates
-        auto alpha = dot(normal, cross(c - b, p - b)) / normal.length_squared();
-        auto beta = dot(normal, cross(a - c, p - c)) / normal.length_squared();
-        auto upsilon = dot(normal, cross(b - a, p - a)) / normal.length_squared();
-
-        //if any negative barycentric coord, then misses the triangle.
-        if (alpha < 0 || beta < 0 || upsilon < 0)
-        {
+        double collision_time, alpha, beta, upsilon;
+        if (!triangle_intersect(triangle_ray(r), ray_t, a, b, c, collision_time, alpha, beta, upsilon))
             return false;
-        }
 
         //Calculate smoothed normal for this hit based on barycentric interpolation of vertex normals
         Vec3 smooth_normal = get_smooth_normal(alpha, beta, upsilon);
 
         rec.t = collision_time;
-        rec.collision = p;
+        rec.collision = r.at(collision_time);
         rec.set_face_normal(r, unit_vector(smooth_normal));
         rec.mat = mat;
+        rec.object = this;
         set_uv_coords_triangle(rec.u, rec.v, alpha, beta, upsilon);
 
         return true;
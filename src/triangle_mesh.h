@@ -0,0 +1,193 @@
+#pragma once
+
+#include "hittable.h"
+#include "triangle.h"
+#include "bvh.h"
+#include "linear_bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+//Indexed triangle mesh. Positions, normals and uvs live in shared per-vertex buffers, each face is
+//three vertex indices plus a material id, and the faces sit under the mesh's own flattened BVH.
+//This replaces one Triangle/Smooth_Triangle object (and its shared_ptr) per face.
+class Triangle_Mesh : public hittable {
+    public:
+    //positions: xyz per vertex
+    //normals: xyz per vertex, or empty for flat shading
+    //uvs: uv per vertex, or empty to use the same fixed corner uvs as Triangle
+    //indices: three vertex indices per face
+    //face_materials: index into materials for every face
+    Triangle_Mesh(std::vector<float> positions, std::vector<float> normals, std::vector<float> uvs,
+                  std::vector<uint32_t> indices, std::vector<uint16_t> face_materials,
+                  std::vector<shared_ptr<material>> materials,
+                  const bvh_build_options& options = bvh_build_options())
+    : positions(std::move(positions)), normals(std::move(normals)), uvs(std::move(uvs)), materials(std::move(materials))
+    {
+        size_t face_count = indices.size() / 3;
+
+        std::vector<Bounding_Box> boxes(face_count);
+        #pragma omp parallel for if(face_count >= bvh_parallel_grain)
+        for (size_t face = 0; face < face_count; face++) {
+            point3 a = vertex(indices[3*face + 0]);
+            point3 b = vertex(indices[3*face + 1]);
+            point3 c = vertex(indices[3*face + 2]);
+            boxes[face] = Bounding_Box(
+                interval(std::fmin(std::fmin(a.x, b.x), c.x), std::fmax(std::fmax(a.x, b.x), c.x)),
+                interval(std::fmin(std::fmin(a.y, b.y), c.y), std::fmax(std::fmax(a.y, b.y), c.y)),
+                interval(std::fmin(std::fmin(a.z, b.z), c.z), std::fmax(std::fmax(a.z, b.z), c.z))
+            );
+        }
+
+        linear_bvh_builder builder(boxes, options);
+        builder.build();
+        nodes = std::move(builder.nodes);
+
+        //store the faces in leaf order so a leaf range indexes them directly
+        face_indices.resize(3 * face_count);
+        this->face_materials.resize(face_count);
+        for (size_t slot = 0; slot < face_count; slot++) {
+            uint32_t face = builder.primitive_order[slot];
+            for (int corner = 0; corner < 3; corner++)
+                face_indices[3*slot + corner] = indices[3*face + corner];
+            this->face_materials[slot] = face_materials.empty() ? 0 : face_materials[face];
+        }
+
+        bbox = nodes.empty() ? Bounding_Box::empty : nodes[0].bounding_box();
+    }
+
+    bool hit(const Ray& r, interval ray_t, hit_record& rec) const override {
+        uint32_t closest_face = 0;
+        double closest_t = 0, alpha = 0, beta = 0, upsilon = 0;
+        //ray setup shared by every face tested
+        const triangle_ray prepared(r);
+
+        bool hit_anything = linear_bvh_traverse(nodes, r, ray_t, [&](uint32_t first, uint32_t count, interval& leaf_t) {
+            bool hit_leaf = false;
+            for (uint32_t face = first; face < first + count; face++) {
+                double t, a, b, c;
+                if (intersect_face(face, prepared, leaf_t, t, a, b, c)) {
+                    hit_leaf = true;
+                    leaf_t.max = t;
+                    closest_face = face;
+                    closest_t = t;
+                    alpha = a; beta = b; upsilon = c;
+                }
+            }
+            return hit_leaf;
+        });
+
+        if (!hit_anything)
+            return false;
+
+        shade_face(r, closest_face, closest_t, alpha, beta, upsilon, rec);
+        return true;
+    }
+
+    bool occluded(const Ray& r, interval ray_t) const override {
+        const triangle_ray prepared(r);
+        return linear_bvh_traverse(nodes, r, ray_t, [&](uint32_t first, uint32_t count, interval& leaf_t) {
+            for (uint32_t face = first; face < first + count; face++) {
+                double t, a, b, c;
+                if (intersect_face(face, prepared, leaf_t, t, a, b, c))
+                    return true;
+            }
+            return false;
+        }, 0, bvh_query::any);
+    }
+
+    uint32_t hit_packet(ray_packet& packet, uint32_t active, hit_record* recs) const override {
+        uint32_t closest_face[ray_packet::max_size];
+        double closest_t[ray_packet::max_size], alpha[ray_packet::max_size], beta[ray_packet::max_size], upsilon[ray_packet::max_size];
+        triangle_ray prepared[ray_packet::max_size];
+        for (int lane = 0; lane < packet.size; lane++) {
+            if (active & (1u << lane))
+                prepared[lane] = triangle_ray(packet.rays[lane]);
+        }
+
+        uint32_t hits = linear_bvh_traverse_packet(nodes, packet, active, [&](uint32_t first, uint32_t count, int lane, interval& leaf_t) {
+            bool hit_leaf = false;
+            for (uint32_t face = first; face < first + count; face++) {
+                double t, a, b, c;
+                if (intersect_face(face, prepared[lane], leaf_t, t, a, b, c)) {
+                    hit_leaf = true;
+                    leaf_t.max = t;
+                    closest_face[lane] = face;
+                    closest_t[lane] = t;
+                    alpha[lane] = a; beta[lane] = b; upsilon[lane] = c;
+                }
+            }
+            return hit_leaf;
+        });
+
+        for (int lane = 0; lane < packet.size; lane++) {
+            if (hits & (1u << lane))
+                shade_face(packet.rays[lane], closest_face[lane], closest_t[lane], alpha[lane], beta[lane], upsilon[lane], recs[lane]);
+        }
+        return hits;
+    }
+
+    Bounding_Box bounding_box() const override { return bbox; }
+
+    size_t face_count() const { return face_materials.size(); }
+    size_t vertex_count() const { return positions.size() / 3; }
+
+    //bytes held by the mesh buffers and its BVH
+    size_t memory_bytes() const {
+        return positions.size() * sizeof(float) + normals.size() * sizeof(float) + uvs.size() * sizeof(float)
+             + face_indices.size() * sizeof(uint32_t) + face_materials.size() * sizeof(uint16_t)
+             + nodes.size() * sizeof(linear_bvh_node);
+    }
+
+    private:
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> uvs;
+    std::vector<uint32_t> face_indices;     //in BVH leaf order
+    std::vector<uint16_t> face_materials;   //in BVH leaf order
+    std::vector<shared_ptr<material>> materials;
+    std::vector<linear_bvh_node> nodes;
+    Bounding_Box bbox;
+
+    point3 vertex(uint32_t i) const {
+        return point3(positions[3*i + 0], positions[3*i + 1], positions[3*i + 2]);
+    }
+
+    Vec3 normal(uint32_t i) const {
+        return Vec3(normals[3*i + 0], normals[3*i + 1], normals[3*i + 2]);
+    }
+
+    //fills rec with the shading data of a face hit at t, with barycentric coordinates alpha, beta, upsilon
+    void shade_face(const Ray& r, uint32_t face, double t, double alpha, double beta, double upsilon, hit_record& rec) const {
+        uint32_t i0 = face_indices[3*face + 0];
+        uint32_t i1 = face_indices[3*face + 1];
+        uint32_t i2 = face_indices[3*face + 2];
+
+        Vec3 outward_normal = cross(vertex(i1) - vertex(i0), vertex(i2) - vertex(i0));
+        if (!normals.empty()) {
+            Vec3 smooth_normal = alpha*normal(i0) + beta*normal(i1) + upsilon*normal(i2);
+            //vertices without a normal in the source data fall back to the face normal
+            if (!smooth_normal.near_zero())
+                outward_normal = smooth_normal;
+        }
+
+        rec.t = t;
+        rec.collision = r.at(t);
+        rec.set_face_normal(r, unit_vector(outward_normal));
+        rec.mat = materials[face_materials[face]];
+        rec.object = this;
+
+        if (uvs.empty()) {
+            Triangle::set_uv_coords_triangle(rec.u, rec.v, alpha, beta, upsilon);
+        }
+        else {
+            rec.u = alpha*uvs[2*i0 + 0] + beta*uvs[2*i1 + 0] + upsilon*uvs[2*i2 + 0];
+            rec.v = alpha*uvs[2*i0 + 1] + beta*uvs[2*i1 + 1] + upsilon*uvs[2*i2 + 1];
+        }
+    }
+
+    bool intersect_face(uint32_t face, const triangle_ray& ray, const interval& ray_t, double& t, double& alpha, double& beta, double& upsilon) const {
+        return triangle_intersect(ray, ray_t, vertex(face_indices[3*face + 0]), vertex(face_indices[3*face + 1]), vertex(face_indices[3*face + 2]),
+                                  t, alpha, beta, upsilon);
+    }
+};
@@ -6,12 +6,11 @@
 #include <memory>
 #include <cstdlib>
 #include <omp.h> 
-#include <random>
 
 #define triangle_epsilon 1e-8
-#define cmpfloat(x, y) (abs(x-y) < triangle_epsilon)
-#define MIN(x, y) (cmpfloat(x, y) ? y : x)
-#define MAX(x, y) (cmpfloat(x, y) ? x : y)
+#define cmpfloat(x, y) (std::fabs((x)-(y)) < triangle_epsilon)
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
 
 // C++ Std Usings
 using std::make_shared;
@@ -26,25 +25,7 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
-//returns canonical {in [0,1)} random real.
-inline double random_double()
-{
-    thread_local static std::mt19937 gen(std::random_device{}());
-    thread_local static std::uniform_real_distribution<double> dist(0.0, 1.0);
-    return dist(gen);
-}
-
-//returns random real in [min, max).
-inline double random_double(double min, double max)
-{
-    return min + random_double() * (max-min);
-}
-
-//returns a random int in [min, max].
-inline int random_int(int min, int max)
-{
-    return int(random_double(min, max+1));
-}
+#include "random.h"
 
 
 // Common Headers
@@ -52,3 +33,4 @@ inline int random_int(int min, int max)
 #include "interval.h"
 #include "ray.h"
 #include "vec3.h"
+#include "warp.h"
@@ -162,37 +162,6 @@ inline Vec3 random_vector(double min, double max)
     return Vec3(random_double(min, max), random_double(min, max), random_double(min, max));
 }
 
-//returns random unit vector
-inline Vec3 random_unit_vector() {
-    while (true) {
-        auto p = random_vector(-1,1);
-        auto lensq = p.length_squared();
-        if (1e-160 < lensq && lensq <= 1)
-            return p / sqrt(lensq);
-    }
-}
-
-//returns random vector in unit disk
-inline Vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = Vec3(random_double(-1, 1), random_double(-1, 1), 0);
-        if (p.length_squared() < 1)
-        {
-            return p;
-        }
-    }
-}
-
-
-//returns a random unit vector on the hemisphere according to the input normal
-inline Vec3 random_on_hemisphere(const Vec3& normal) {
-    Vec3 on_unit_sphere = random_unit_vector();
-    if (dot(on_unit_sphere, normal) > 0.0)
-        return on_unit_sphere;
-    else
-        return -on_unit_sphere;
-}
-
 //returns symetric reflection of the input vector about the input normal vector
 inline Vec3 reflect(const Vec3& in, const Vec3& normal) {
     return Vec3(in - (2 * normal * dot(in, normal)));
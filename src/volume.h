@@ -53,6 +53,7 @@ class constant_medium : public hittable {
         rec.front_face = true;
 
         rec.mat = phase_function;
+        rec.object = this;
 
         return true;
     }
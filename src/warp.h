@@ -0,0 +1,191 @@
+#pragma once
+
+#include "vec3.h"
+
+#include <algorithm>
+#include <cmath>
+
+//Closed-form warps from the unit square to directions and points. Each takes two uniform numbers and
+//maps them without rejection, so every call draws exactly two numbers (the dimensions a sampler places)
+//and nearby (u1, u2) land nearby, which keeps stratified points stratified.
+//They hold no state and branch only in selects, so they can be evaluated lane by lane inside SIMD loops.
+//Each returns the pdf of what it picked, per unit solid angle for directions and per unit area for points.
+
+const double inv_pi = 1 / pi;
+
+struct warp_sample {
+    Vec3 value; //direction or point
+    double pdf;
+};
+
+//orthonormal frame around a unit vector w (Duff et al., "Building an Orthonormal Basis, Revisited"), no branches
+struct onb {
+    Vec3 u, v, w;
+
+    explicit onb(const Vec3& normal) : w(normal)
+    {
+        double sign = std::copysign(1.0, w.z);
+        double a = -1 / (sign + w.z);
+        double b = w.x * w.y * a;
+        u = Vec3(1 + sign * w.x * w.x * a, sign * b, -sign * w.x);
+        v = Vec3(b, sign + w.y * w.y * a, -w.y);
+    }
+
+    //local (x, y, z) coordinates, with z along w, to world
+    Vec3 to_world(const Vec3& local) const { return local.x * u + local.y * v + local.z * w; }
+
+    Vec3 to_local(const Vec3& world) const { return Vec3(dot(world, u), dot(world, v), dot(world, w)); }
+};
+
+inline double uniform_sphere_pdf() { return 1 / (4 * pi); }
+
+//uniform direction: z uniform in [-1, 1] (Archimedes), angle uniform around z
+inline warp_sample warp_uniform_sphere(double u1, double u2)
+{
+    double z = 1 - 2 * u1;
+    double r = std::sqrt(std::fmax(0.0, 1 - z * z));
+    double phi = 2 * pi * u2;
+    return { Vec3(r * std::cos(phi), r * std::sin(phi), z), uniform_sphere_pdf() };
+}
+
+inline double concentric_disk_pdf() { return inv_pi; }
+
+//Uniform point in the unit disk (z = 0) by Shirley and Chiu's concentric map: squares around the center
+//go to circles, so the map bends the square much less than polar coordinates do.
+inline warp_sample warp_concentric_disk(double u1, double u2)
+{
+    double a = 2 * u1 - 1;
+    double b = 2 * u2 - 1;
+    bool wide = a * a > b * b;
+    //the other branch's ratio must not divide by zero; at the center r is 0 anyway
+    double safe_a = a != 0 ? a : 1;
+    double safe_b = b != 0 ? b : 1;
+    double r = wide ? a : b;
+    double phi = wide ? (pi / 4) * (b / safe_a) : (pi / 2) - (pi / 4) * (a / safe_b);
+    return { Vec3(r * std::cos(phi), r * std::sin(phi), 0), concentric_disk_pdf() };
+}
+
+//cos_theta: cosine between the direction and the axis of the hemisphere
+inline double cosine_hemisphere_pdf(double cos_theta) { return std::fmax(0.0, cos_theta) * inv_pi; }
+
+//Cosine weighted direction around +z, by lifting a uniform disk point onto the hemisphere (Malley's method).
+//Use onb(normal).to_world to put it around a normal.
+inline warp_sample warp_cosine_hemisphere(double u1, double u2)
+{
+    Vec3 d = warp_concentric_disk(u1, u2).value;
+    double z = std::sqrt(std::fmax(0.0, 1 - d.x * d.x - d.y * d.y));
+    return { Vec3(d.x, d.y, z), cosine_hemisphere_pdf(z) };
+}
+
+//cos_theta_max: cosine of the half angle of the cone
+inline double uniform_cone_pdf(double cos_theta_max) { return 1 / (2 * pi * (1 - cos_theta_max)); }
+
+//uniform direction within the cone of half angle acos(cos_theta_max) around +z
+inline warp_sample warp_uniform_cone(double u1, double u2, double cos_theta_max)
+{
+    double z = 1 - u1 * (1 - cos_theta_max);
+    double r = std::sqrt(std::fmax(0.0, 1 - z * z));
+    double phi = 2 * pi * u2;
+    return { Vec3(r * std::cos(phi), r * std::sin(phi), z), uniform_cone_pdf(cos_theta_max) };
+}
+
+//angle between unit vectors a and b, accurate also when they are nearly parallel or opposite
+inline double angle_between(const Vec3& a, const Vec3& b)
+{
+    if (dot(a, b) < 0)
+        return pi - 2 * std::asin(std::fmin(1.0, (a + b).length() / 2));
+    return 2 * std::asin(std::fmin(1.0, (b - a).length() / 2));
+}
+
+//The directions from origin to a rectangle (corner plus orthogonal edges ex and ey), sampled uniformly by
+//solid angle as in Urena et al., "An Area-Preserving Parametrization for Spherical Rectangles".
+//Unlike sampling the area, the density stays bounded for points close to the rectangle.
+struct spherical_rectangle {
+    Vec3 x, y, z;           //frame along the edges, z pointing from the rectangle's plane toward origin
+    double x0, y0, x1, y1, z0; //the rectangle in that frame, relative to origin
+    double b0, b1, k;
+    double solid_angle;
+
+    spherical_rectangle(const point3& origin, const point3& corner, const Vec3& ex, const Vec3& ey)
+    {
+        double ex_length = ex.length(), ey_length = ey.length();
+        x = ex / ex_length;
+        y = ey / ey_length;
+        z = cross(x, y);
+        Vec3 d = corner - origin;
+        z0 = dot(d, z);
+        if (z0 > 0) {
+            z = -z;
+            z0 = -z0;
+        }
+        x0 = dot(d, x);
+        y0 = dot(d, y);
+        x1 = x0 + ex_length;
+        y1 = y0 + ey_length;
+
+        //normals of the planes through origin and each edge, and the angles between them
+        Vec3 v00(x0, y0, z0), v01(x0, y1, z0), v10(x1, y0, z0), v11(x1, y1, z0);
+        Vec3 n0 = unit_vector(cross(v00, v10));
+        Vec3 n1 = unit_vector(cross(v10, v11));
+        Vec3 n2 = unit_vector(cross(v11, v01));
+        Vec3 n3 = unit_vector(cross(v01, v00));
+        double g0 = angle_between(-n0, n1), g1 = angle_between(-n1, n2);
+        double g2 = angle_between(-n2, n3), g3 = angle_between(-n3, n0);
+
+        b0 = n0.z;
+        b1 = n2.z;
+        k = -g2 - g3;
+        solid_angle = g0 + g1 + g2 + g3 - 2 * pi;
+        //origin in the rectangle's plane sees no solid angle, and the frame is not valid
+        if (!(z0 < 0) || !(solid_angle > 0))
+            solid_angle = 0;
+    }
+
+    //direction from origin to a point of the rectangle, uniform in solid angle (density 1 / solid_angle)
+    Vec3 sample(double u1, double u2) const
+    {
+        double au = u1 * solid_angle + k;
+        double fu = (std::cos(au) * b0 - b1) / std::sin(au);
+        double cu = std::copysign(1 / std::sqrt(fu * fu + b0 * b0), fu);
+        cu = std::clamp(cu, -0.9999999999999999, 0.9999999999999999);
+        double xu = std::clamp(-(cu * z0) / std::sqrt(1 - cu * cu), x0, x1);
+
+        double dd = std::sqrt(xu * xu + z0 * z0);
+        double h0 = y0 / std::sqrt(dd * dd + y0 * y0);
+        double h1 = y1 / std::sqrt(dd * dd + y1 * y1);
+        double hv = h0 + u2 * (h1 - h0);
+        double yv = hv * hv < 1 - 1e-12 ? (hv * dd) / std::sqrt(1 - hv * hv) : y1;
+        return xu * x + yv * y + z0 * z;
+    }
+};
+
+//returns random unit vector
+inline Vec3 random_unit_vector()
+{
+    double u1 = random_double();
+    return warp_uniform_sphere(u1, random_double()).value;
+}
+
+//returns random vector in unit disk
+inline Vec3 random_in_unit_disk()
+{
+    double u1 = random_double();
+    return warp_concentric_disk(u1, random_double()).value;
+}
+
+//returns a cosine weighted random unit vector on the hemisphere around the input unit normal
+inline Vec3 random_cosine_direction(const Vec3& normal)
+{
+    double u1 = random_double();
+    return onb(normal).to_world(warp_cosine_hemisphere(u1, random_double()).value);
+}
+
+//returns a random unit vector on the hemisphere according to the input normal
+inline Vec3 random_on_hemisphere(const Vec3& normal)
+{
+    Vec3 on_unit_sphere = random_unit_vector();
+    if (dot(on_unit_sphere, normal) > 0.0)
+        return on_unit_sphere;
+    else
+        return -on_unit_sphere;
+}
@@ -0,0 +1,339 @@
+#pragma once
+
+#include "hittable.h"
+#include "bounding_box.h"
+#include "hittable_list.h"
+#include "bvh.h"
+#include "linear_bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+//marks an unused child slot of a wide node
+const uint32_t wide_bvh_empty_slot = 0xffffffff;
+
+//Node of a Width-ary BVH with the child boxes stored as structure of arrays,
+//so one ray can be tested against all children at once.
+//A child slot is either another node (count == 0), a leaf range of primitives (count > 0) or empty.
+template <int Width>
+struct alignas(32) wide_bvh_node {
+    float bounds[2][3][Width];  //[min/max][axis][child]
+    uint32_t child[Width];      //node index, leaf primitive offset, or wide_bvh_empty_slot
+    uint8_t count[Width];       //primitives in a leaf child, 0 for node children and empty slots
+
+    void clear() {
+        for (int i = 0; i < Width; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                //an inverted box can never be hit
+                bounds[0][axis][i] = std::numeric_limits<float>::infinity();
+                bounds[1][axis][i] = -std::numeric_limits<float>::infinity();
+            }
+            child[i] = wide_bvh_empty_slot;
+            count[i] = 0;
+        }
+    }
+
+    void set_child_bounds(int slot, const linear_bvh_node& box) {
+        for (int axis = 0; axis < 3; axis++) {
+            bounds[0][axis][slot] = box.bounds[0][axis];
+            bounds[1][axis][slot] = box.bounds[1][axis];
+        }
+    }
+};
+
+//single precision copy of a ray, prepared for the wide slab tests
+struct wide_bvh_ray {
+    float origin[3];
+    float inv_dir[3];
+    int dir_is_neg[3];
+
+    wide_bvh_ray(const Ray& r) {
+        for (int axis = 0; axis < 3; axis++) {
+            origin[axis] = float(r.origin[axis]);
+            inv_dir[axis] = float(r.inv_direction[axis]);
+            dir_is_neg[axis] = inv_dir[axis] < 0;
+        }
+    }
+};
+
+//widens the far distance so float rounding in the slab test cannot miss a box the ray grazes
+const float wide_bvh_far_scale = 1.0f + 2.0f * 3.0f * std::numeric_limits<float>::epsilon();
+
+//Tests a ray against every child box of a node. Returns a bitmask of the children hit
+//and writes the entry distance of each child to t_near. Portable version, used
+//whenever no vector instruction set matches the node width.
+template <int Width>
+inline int wide_bvh_hit_children(const wide_bvh_node<Width>& node, const wide_bvh_ray& ray, float t_min, float t_max, float* t_near)
+{
+    int mask = 0;
+    for (int i = 0; i < Width; i++) {
+        float lane_min = t_min;
+        float lane_max = t_max;
+        for (int axis = 0; axis < 3; axis++) {
+            float near = (node.bounds[ray.dir_is_neg[axis]][axis][i] - ray.origin[axis]) * ray.inv_dir[axis];
+            float far = (node.bounds[1 - ray.dir_is_neg[axis]][axis][i] - ray.origin[axis]) * ray.inv_dir[axis] * wide_bvh_far_scale;
+            //written so a NaN from 0 * infinity leaves the interval untouched
+            if (near > lane_min) lane_min = near;
+            if (far < lane_max) lane_max = far;
+        }
+        t_near[i] = lane_min;
+        if (lane_min <= lane_max)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+#if defined(__SSE__) || defined(_M_X64)
+//4 children per SSE register
+template <>
+inline int wide_bvh_hit_children<4>(const wide_bvh_node<4>& node, const wide_bvh_ray& ray, float t_min, float t_max, float* t_near)
+{
+    __m128 lane_min = _mm_set1_ps(t_min);
+    __m128 lane_max = _mm_set1_ps(t_max);
+    const __m128 far_scale = _mm_set1_ps(wide_bvh_far_scale);
+
+    for (int axis = 0; axis < 3; axis++) {
+        __m128 origin = _mm_set1_ps(ray.origin[axis]);
+        __m128 inv_dir = _mm_set1_ps(ray.inv_dir[axis]);
+        __m128 near = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[ray.dir_is_neg[axis]][axis]), origin), inv_dir);
+        __m128 far = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[1 - ray.dir_is_neg[axis]][axis]), origin), inv_dir), far_scale);
+        //max/min return their second operand when the first is NaN
+        lane_min = _mm_max_ps(near, lane_min);
+        lane_max = _mm_min_ps(far, lane_max);
+    }
+
+    _mm_storeu_ps(t_near, lane_min);
+    return _mm_movemask_ps(_mm_cmple_ps(lane_min, lane_max));
+}
+#endif
+
+#if defined(__AVX__)
+//8 children per AVX register
+template <>
+inline int wide_bvh_hit_children<8>(const wide_bvh_node<8>& node, const wide_bvh_ray& ray, float t_min, float t_max, float* t_near)
+{
+    __m256 lane_min = _mm256_set1_ps(t_min);
+    __m256 lane_max = _mm256_set1_ps(t_max);
+    const __m256 far_scale = _mm256_set1_ps(wide_bvh_far_scale);
+
+    for (int axis = 0; axis < 3; axis++) {
+        __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+        __m256 inv_dir = _mm256_set1_ps(ray.inv_dir[axis]);
+        __m256 near = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bounds[ray.dir_is_neg[axis]][axis]), origin), inv_dir);
+        __m256 far = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bounds[1 - ray.dir_is_neg[axis]][axis]), origin), inv_dir), far_scale);
+        //max/min return their second operand when the first is NaN
+        lane_min = _mm256_max_ps(near, lane_min);
+        lane_max = _mm256_min_ps(far, lane_max);
+    }
+
+    _mm256_storeu_ps(t_near, lane_min);
+    return _mm256_movemask_ps(_mm256_cmp_ps(lane_min, lane_max, _CMP_LE_OQ));
+}
+#endif
+
+//BVH with Width (4 or 8) children per node, collapsed from a binary Linear_BVH build.
+//Each node is tested against the ray in one vector slab test and the hit children are visited nearest first.
+template <int Width>
+class Wide_BVH : public hittable {
+    static_assert(Width >= 2 && Width <= 8, "Wide_BVH supports 2 to 8 children per node");
+
+    public:
+    Wide_BVH(const hittable_list& list, const bvh_build_options& options = bvh_build_options())
+    : Wide_BVH(list.objects, options) {}
+
+    Wide_BVH(const std::vector<shared_ptr<hittable>>& objects, const bvh_build_options& options = bvh_build_options()) {
+        std::vector<Bounding_Box> boxes(objects.size());
+        #pragma omp parallel for if(objects.size() >= bvh_parallel_grain)
+        for (size_t i = 0; i < objects.size(); i++)
+            boxes[i] = objects[i]->bounding_box();
+
+        linear_bvh_builder builder(boxes, options);
+        builder.build();
+
+        primitives.reserve(objects.size());
+        for (auto index : builder.primitive_order)
+            primitives.push_back(objects[index]);
+
+        if (builder.nodes.empty()) {
+            bbox = Bounding_Box::empty;
+            return;
+        }
+
+        bbox = builder.nodes[0].bounding_box();
+        collapse_root(builder.nodes);
+    }
+
+    bool hit(const Ray& r, interval ray_t, hit_record& rec) const override {
+        return traverse(r, ray_t, [&](uint32_t first, uint32_t count, interval& leaf_t) {
+            bool hit_leaf = false;
+            for (uint32_t i = first; i < first + count; i++) {
+                if (primitives[i]->hit(r, leaf_t, rec)) {
+                    hit_leaf = true;
+                    leaf_t.max = rec.t;
+                }
+            }
+            return hit_leaf;
+        }, bvh_query::closest);
+    }
+
+    bool occluded(const Ray& r, interval ray_t) const override {
+        return traverse(r, ray_t, [&](uint32_t first, uint32_t count, interval& leaf_t) {
+            for (uint32_t i = first; i < first + count; i++) {
+                if (primitives[i]->occluded(r, leaf_t))
+                    return true;
+            }
+            return false;
+        }, bvh_query::any);
+    }
+
+    void collect_lights(std::vector<const hittable*>& lights) const override {
+        for (const auto& object : primitives)
+            object->collect_lights(lights);
+    }
+
+    Bounding_Box bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    private:
+    struct stack_entry {
+        uint32_t index;     //node index, or first primitive of a leaf
+        uint32_t count;     //primitives in a leaf, 0 for nodes
+        float t_near;       //distance at which the ray enters the box
+    };
+
+    std::vector<wide_bvh_node<Width>> nodes;
+    std::vector<shared_ptr<hittable>> primitives;
+    Bounding_Box bbox;
+
+    //Walks the tree nearest child first. intersect_leaf(first, count, ray_t) tests a leaf range and
+    //returns true after lowering ray_t.max to a closer hit. An any-hit query stops at the first hit.
+    template <typename LeafFn>
+    bool traverse(const Ray& r, interval ray_t, LeafFn intersect_leaf, bvh_query query) const {
+        if (nodes.empty())
+            return false;
+
+        wide_bvh_ray ray(r);
+
+        //every level pushes at most Width entries and pops one
+        stack_entry stack[linear_bvh_max_depth * Width];
+        int stack_size = 0;
+        stack[stack_size++] = { 0, 0, float(ray_t.min) };
+        bool hit_anything = false;
+
+        while (stack_size > 0) {
+            stack_entry entry = stack[--stack_size];
+
+            //skip anything that starts beyond the closest hit found so far
+            if (entry.t_near > ray_t.max)
+                continue;
+
+            if (entry.count > 0) {
+                if (intersect_leaf(entry.index, entry.count, ray_t)) {
+                    hit_anything = true;
+                    if (query == bvh_query::any)
+                        return true;
+                }
+                continue;
+            }
+
+            const wide_bvh_node<Width>& node = nodes[entry.index];
+            alignas(32) float t_near[Width];
+            int mask = wide_bvh_hit_children<Width>(node, ray, float(ray_t.min), float(ray_t.max), t_near);
+
+            //sort the hit children by entry distance
+            int order[Width];
+            int hit_count = 0;
+            for (int i = 0; i < Width; i++) {
+                if (!(mask & (1 << i)) || node.child[i] == wide_bvh_empty_slot)
+                    continue;
+                int j = hit_count++;
+                while (j > 0 && t_near[order[j - 1]] > t_near[i]) {
+                    order[j] = order[j - 1];
+                    j--;
+                }
+                order[j] = i;
+            }
+
+            //push farthest first so the nearest child is popped next
+            for (int j = hit_count - 1; j >= 0; j--) {
+                int i = order[j];
+                stack[stack_size++] = { node.child[i], node.count[i], t_near[i] };
+            }
+        }
+
+        return hit_anything;
+    }
+
+    void collapse_root(const std::vector<linear_bvh_node>& binary) {
+        if (binary[0].is_leaf()) {
+            //a single leaf still needs a node so traversal can start somewhere
+            nodes.emplace_back();
+            nodes[0].clear();
+            nodes[0].set_child_bounds(0, binary[0]);
+            nodes[0].child[0] = binary[0].primitives_offset;
+            nodes[0].count[0] = uint8_t(binary[0].primitive_count);
+            return;
+        }
+        collapse(binary, 0);
+    }
+
+    //Turns the binary interior node at binary_index into a wide node by repeatedly
+    //opening the child with the largest surface area until Width children are gathered.
+    uint32_t collapse(const std::vector<linear_bvh_node>& binary, uint32_t binary_index) {
+        uint32_t children[Width];
+        int child_count = 2;
+        children[0] = binary_index + 1;
+        children[1] = binary[binary_index].second_child_offset;
+
+        while (child_count < Width) {
+            int widest = -1;
+            double widest_area = -1;
+            for (int i = 0; i < child_count; i++) {
+                const linear_bvh_node& candidate = binary[children[i]];
+                if (candidate.is_leaf())
+                    continue;
+                double area = candidate.bounding_box().surface_area();
+                if (area > widest_area) {
+                    widest_area = area;
+                    widest = i;
+                }
+            }
+            if (widest < 0)
+                break;
+
+            uint32_t opened = children[widest];
+            children[widest] = opened + 1;
+            children[child_count++] = binary[opened].second_child_offset;
+        }
+
+        uint32_t node_index = uint32_t(nodes.size());
+        nodes.emplace_back();
+        nodes[node_index].clear();
+
+        for (int i = 0; i < child_count; i++) {
+            const linear_bvh_node& child = binary[children[i]];
+            nodes[node_index].set_child_bounds(i, child);
+
+            if (child.is_leaf()) {
+                nodes[node_index].child[i] = child.primitives_offset;
+                nodes[node_index].count[i] = uint8_t(child.primitive_count);
+            }
+            else {
+                //nodes may reallocate while the child is built, so index rather than hold a reference
+                uint32_t wide_child = collapse(binary, children[i]);
+                nodes[node_index].child[i] = wide_child;
+                nodes[node_index].count[i] = 0;
+            }
+        }
+
+        return node_index;
+    }
+};
+
+using BVH4 = Wide_BVH<4>;
+using BVH8 = Wide_BVH<8>;
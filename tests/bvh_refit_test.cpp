@@ -0,0 +1,101 @@
+// Checks that a Linear_BVH refit after its spheres move (Sphere::set_center, then Linear_BVH::refit or update)
+// finds the same hits as a tree freshly built over the moved spheres: the same nearest object at the same t,
+// and the same occlusion answers. Covers small and large moves, moving spheres with a position function,
+// and update() both keeping the refit tree and rebuilding it. Seeds are fixed.
+//
+// Run: build/BVH_Refit_Test (or ctest), exits with 1 if any check fails
+
+#include "utility.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "sphere.h"
+
+#include <cstdio>
+#include <vector>
+
+static int failures = 0;
+
+static void check(const char* name, bool passed, double value, double limit)
+{
+    std::printf("%-52s %s (%g, limit %g)\n", name, passed ? "PASS" : "FAIL", value, limit);
+    if (!passed)
+        failures++;
+}
+
+static point3 drift(double t, const point3& origin) { return point3(origin.x + 0.5 * t, origin.y, origin.z - 0.3 * t); }
+
+//rays from outside the spheres' cube toward random points inside it, at random shutter times
+static std::vector<Ray> random_rays(int count)
+{
+    std::vector<Ray> rays;
+    for (int i = 0; i < count; i++) {
+        point3 origin = 30 * random_unit_vector();
+        point3 target = random_vector(-10, 10);
+        rays.push_back(Ray(origin, target - origin, random_double()));
+    }
+    return rays;
+}
+
+//number of rays for which refit and fresh trees disagree on the nearest hit or on occlusion
+static int mismatches(const Linear_BVH& refit, const Linear_BVH& fresh, const std::vector<Ray>& rays)
+{
+    int count = 0;
+    for (const Ray& r : rays) {
+        hit_record a, b;
+        bool hit_a = refit.hit(r, interval(0.001, infinity), a);
+        bool hit_b = fresh.hit(r, interval(0.001, infinity), b);
+        if (hit_a != hit_b || (hit_a && (a.t != b.t || a.object != b.object)))
+            count++;
+        else if (refit.occluded(r, interval(0.001, 25)) != fresh.occluded(r, interval(0.001, 25)))
+            count++;
+    }
+    return count;
+}
+
+int main()
+{
+    random_seed(17);
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    //spheres in a cube, every tenth one with motion blur, in a SAH tree like the scenes build
+    std::vector<shared_ptr<Sphere>> spheres;
+    hittable_list list;
+    for (int i = 0; i < 20000; i++) {
+        point3 center = random_vector(-10, 10);
+        double radius = random_double(0.02, 0.1);
+        auto sphere = i % 10 == 0 ? make_shared<Sphere>(center, radius, drift, mat) : make_shared<Sphere>(center, radius, mat);
+        spheres.push_back(sphere);
+        list.add(sphere);
+    }
+    bvh_build_options options;
+    options.split_method = bvh_split_method::sah;
+    Linear_BVH bvh(list, options);
+    std::vector<Ray> rays = random_rays(20000);
+
+    //every sphere drifts a little, as between animation frames: the refit tree stays good enough to keep
+    for (auto& sphere : spheres)
+        sphere->set_center(sphere->get_center() + random_vector(-0.02, 0.02));
+    bool rebuilt = bvh.update();
+    double growth = bvh.sah_cost(options.traversal_cost) / bvh.build_sah_cost();
+    int wrong = mismatches(bvh, Linear_BVH(list, options), rays);
+    check("update after a small drift keeps the refit tree", !rebuilt && growth <= 1.5, growth, 1.5);
+    check("update after a small drift matches a fresh build", wrong == 0, wrong, 0);
+
+    //a few spheres jump across the cube, stretching the boxes of every node above them
+    for (int i = 0; i < 200; i++)
+        spheres[random_int(0, int(spheres.size()) - 1)]->set_center(random_vector(-10, 10));
+    bvh.refit();
+    wrong = mismatches(bvh, Linear_BVH(list, options), rays);
+    check("refit after 1% of spheres jump matches a fresh build", wrong == 0, wrong, 0);
+
+    //so much that update rebuilds
+    rebuilt = bvh.update();
+    growth = bvh.sah_cost(options.traversal_cost) / bvh.build_sah_cost();
+    wrong = mismatches(bvh, Linear_BVH(list, options), rays);
+    check("update after the jumps rebuilds", rebuilt && growth == 1, growth, 1);
+    check("update after the jumps matches a fresh build", wrong == 0, wrong, 0);
+
+    if (failures)
+        std::printf("%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
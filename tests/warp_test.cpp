@@ -0,0 +1,233 @@
+// Checks of the warps in warp.h: each warp's samples are histogrammed against its pdf (chi-square over cells
+// of equal probability), each pdf integrates to one, onb frames are orthonormal, and the solid angle of
+// spherical_rectangle matches a Monte Carlo estimate. Seeds are fixed, so the results do not change run to run.
+//
+// Run: build/Warp_Test (or ctest), exits with 1 if any check fails
+
+#include "utility.h"
+
+#include <cstdio>
+#include <functional>
+#include <utility>
+#include <vector>
+
+static int failures = 0;
+
+static void check(const char* name, bool passed, double value, double limit)
+{
+    std::printf("%-48s %s (%g, limit %g)\n", name, passed ? "PASS" : "FAIL", value, limit);
+    if (!passed)
+        failures++;
+}
+
+//Chi-square of n samples of a warp over cells x cells bins. cell() maps the warp of (u1, u2) to its bin, chosen
+//so that every bin has the same probability under the warp's pdf, or returns -1 for a sample outside the domain.
+static double chi_square(const std::function<int(double, double)>& cell, int cells, int n)
+{
+    std::vector<double> histogram(cells * cells, 0);
+    random_seed(7);
+    for (int i = 0; i < n; i++) {
+        double u1 = random_double();
+        int c = cell(u1, random_double());
+        if (c < 0 || c >= cells * cells)
+            return infinity;
+        histogram[c]++;
+    }
+    double expected = double(n) / (cells * cells), sum = 0;
+    for (double count : histogram)
+        sum += (count - expected) * (count - expected) / expected;
+    return sum;
+}
+
+//Monte Carlo integral: sample(u1, u2, value) picks a point, sets the integrand's value there and returns the
+//point's pdf. Returns the estimate and its standard error.
+static std::pair<double, double> integrate(const std::function<double(double, double, double&)>& sample, int n)
+{
+    random_seed(3);
+    double sum = 0, sum_squares = 0;
+    for (int i = 0; i < n; i++) {
+        double u1 = random_double(), value = 0;
+        double pdf = sample(u1, random_double(), value);
+        double x = value / pdf;
+        sum += x;
+        sum_squares += x * x;
+    }
+    double mean = sum / n;
+    return { mean, std::sqrt(std::fmax(0.0, sum_squares / n - mean * mean) / n) };
+}
+
+static void test_warp_distributions()
+{
+    //16 x 16 cells leave 255 degrees of freedom: mean 255, standard deviation 22.6, so 350 fails about 1 in 10^4
+    const int cells = 16, n = 4000000;
+    const double limit = 350;
+    auto bin = [&](double a, double b) { return std::min(cells - 1, int(a * cells)) * cells + std::min(cells - 1, int(b * cells)); };
+    auto azimuth = [](const Vec3& d) {
+        double phi = std::atan2(d.y, d.x);
+        return (phi < 0 ? phi + 2 * pi : phi) / (2 * pi);
+    };
+
+    //uniform sphere: (1 - z) / 2 and the azimuth are uniform
+    double x = chi_square([&](double u1, double u2) {
+        Vec3 d = warp_uniform_sphere(u1, u2).value;
+        return std::fabs(d.length() - 1) > 1e-12 ? -1 : bin((1 - d.z) / 2, azimuth(d));
+    }, cells, n);
+    check("uniform sphere histogram chi-square", x < limit, x, limit);
+
+    //concentric disk: r^2 and the azimuth are uniform
+    x = chi_square([&](double u1, double u2) {
+        Vec3 p = warp_concentric_disk(u1, u2).value;
+        return p.length_squared() > 1 + 1e-12 || p.z != 0 ? -1 : bin(p.length_squared(), azimuth(p));
+    }, cells, n);
+    check("concentric disk histogram chi-square", x < limit, x, limit);
+
+    //cosine hemisphere: z^2 and the azimuth are uniform
+    x = chi_square([&](double u1, double u2) {
+        Vec3 d = warp_cosine_hemisphere(u1, u2).value;
+        return d.z < 0 || std::fabs(d.length() - 1) > 1e-12 ? -1 : bin(d.z * d.z, azimuth(d));
+    }, cells, n);
+    check("cosine hemisphere histogram chi-square", x < limit, x, limit);
+
+    //uniform cone: z is uniform in [cos_theta_max, 1], and the azimuth too
+    for (double cos_theta_max : { 0.8, -0.5 }) {
+        x = chi_square([&](double u1, double u2) {
+            Vec3 d = warp_uniform_cone(u1, u2, cos_theta_max).value;
+            if (d.z < cos_theta_max - 1e-12 || std::fabs(d.length() - 1) > 1e-12)
+                return -1;
+            return bin((1 - d.z) / (1 - cos_theta_max), azimuth(d));
+        }, cells, n);
+        check(cos_theta_max > 0 ? "uniform cone (narrow) histogram chi-square" : "uniform cone (wide) histogram chi-square",
+            x < limit, x, limit);
+    }
+
+    //the returned pdf is the one the warp claims
+    bool consistent = true;
+    random_seed(5);
+    for (int i = 0; i < 100000; i++) {
+        double u1 = random_double(), u2 = random_double();
+        warp_sample cosine = warp_cosine_hemisphere(u1, u2);
+        warp_sample cone = warp_uniform_cone(u1, u2, 0.8);
+        consistent = consistent && cosine.pdf == cosine_hemisphere_pdf(cosine.value.z)
+            && cone.pdf == uniform_cone_pdf(0.8)
+            && warp_uniform_sphere(u1, u2).pdf == uniform_sphere_pdf()
+            && warp_concentric_disk(u1, u2).pdf == concentric_disk_pdf();
+    }
+    check("returned pdfs match the pdf functions", consistent, consistent, 1);
+}
+
+static void test_pdf_integrals()
+{
+    const int n = 4000000;
+    //integrate each pdf over its domain with uniform samples of a domain that contains it, within 5 standard errors
+    auto report = [](const char* name, std::pair<double, double> estimate) {
+        double error = std::fabs(estimate.first - 1);
+        check(name, error < 5 * estimate.second + 1e-12, estimate.first, 1);
+    };
+
+    report("uniform sphere pdf integrates to 1", integrate([](double u1, double u2, double& value) {
+        value = uniform_sphere_pdf();
+        return warp_uniform_sphere(u1, u2).pdf;
+    }, n));
+
+    //the disk's pdf over the square [-1, 1]^2
+    report("concentric disk pdf integrates to 1", integrate([](double u1, double u2, double& value) {
+        double a = 2 * u1 - 1, b = 2 * u2 - 1;
+        value = a * a + b * b <= 1 ? concentric_disk_pdf() : 0;
+        return 0.25;
+    }, n));
+
+    report("cosine hemisphere pdf integrates to 1", integrate([](double u1, double u2, double& value) {
+        warp_sample s = warp_uniform_sphere(u1, u2);
+        value = cosine_hemisphere_pdf(s.value.z);
+        return s.pdf;
+    }, n));
+
+    for (double cos_theta_max : { 0.8, -0.5 }) {
+        report(cos_theta_max > 0 ? "uniform cone (narrow) pdf integrates to 1" : "uniform cone (wide) pdf integrates to 1",
+            integrate([&](double u1, double u2, double& value) {
+                warp_sample s = warp_uniform_sphere(u1, u2);
+                value = s.value.z >= cos_theta_max ? uniform_cone_pdf(cos_theta_max) : 0;
+                return s.pdf;
+            }, n));
+    }
+}
+
+static void test_onb()
+{
+    //random normals, plus the poles, where the sign flips, and normals just beside them
+    std::vector<Vec3> normals = { Vec3(0, 0, 1), Vec3(0, 0, -1), unit_vector(Vec3(1e-9, 0, -1)), unit_vector(Vec3(0, 1e-9, 1)),
+                                  Vec3(1, 0, 0), Vec3(0, 1, 0) };
+    random_seed(11);
+    for (int i = 0; i < 1000000; i++)
+        normals.push_back(random_unit_vector());
+
+    double worst = 0;
+    for (const Vec3& normal : normals) {
+        onb frame(normal);
+        Vec3 local(0.3, -0.5, 0.7);
+        double errors[] = { dot(frame.u, frame.v), dot(frame.u, frame.w), dot(frame.v, frame.w),
+                            frame.u.length() - 1, frame.v.length() - 1, frame.w.length() - 1,
+                            dot(cross(frame.u, frame.v), frame.w) - 1, //right handed
+                            (frame.to_local(frame.to_world(local)) - local).length() };
+        for (double e : errors)
+            worst = std::fmax(worst, std::fabs(e));
+    }
+    check("onb frames are orthonormal", worst < 1e-12, worst, 1e-12);
+}
+
+static void test_spherical_rectangle()
+{
+    //the Cornell box light seen from the floor, from beside it, from nearly in its plane, from very close, and from afar
+    const point3 corner(343, 554, 332);
+    const Vec3 ex(-130, 0, 0), ey(0, 0, -105);
+    const point3 origins[] = { point3(278, 0, 278), point3(300, 555, 300), point3(100, 550, 100),
+                               point3(278, 553.9, 280), point3(5000, 100, 300), point3(400, 600, 200) };
+    const int n = 4000000;
+
+    for (const point3& origin : origins) {
+        spherical_rectangle rectangle(origin, corner, ex, ey);
+
+        //the fraction of uniform directions that hit the rectangle, times the sphere's solid angle
+        random_seed(13);
+        int hits = 0;
+        for (int i = 0; i < n; i++) {
+            double u1 = random_double();
+            Vec3 d = warp_uniform_sphere(u1, random_double()).value;
+            double dz = dot(d, rectangle.z);
+            if (dz >= 0)
+                continue;
+            double t = rectangle.z0 / dz;
+            double px = t * dot(d, rectangle.x), py = t * dot(d, rectangle.y);
+            if (px >= rectangle.x0 && px <= rectangle.x1 && py >= rectangle.y0 && py <= rectangle.y1)
+                hits++;
+        }
+        double p = double(hits) / n;
+        double estimate = 4 * pi * p;
+        double standard_error = 4 * pi * std::sqrt(p * (1 - p) / n);
+        double error = std::fabs(rectangle.solid_angle - estimate);
+        check("spherical rectangle solid angle", error < 5 * standard_error + 1e-6, rectangle.solid_angle, estimate);
+
+        //and every sampled direction points at the rectangle
+        bool on_rectangle = true;
+        for (int i = 0; i < 100000; i++) {
+            double u1 = random_double();
+            Vec3 local = origin + rectangle.sample(u1, random_double()) - corner;
+            double s = dot(local, ex) / ex.length_squared(), t = dot(local, ey) / ey.length_squared();
+            double off_plane = std::fabs(dot(local, unit_vector(cross(ex, ey))));
+            on_rectangle = on_rectangle && s > -1e-9 && s < 1 + 1e-9 && t > -1e-9 && t < 1 + 1e-9 && off_plane < 1e-6;
+        }
+        check("spherical rectangle samples lie on the rectangle", on_rectangle, on_rectangle, 1);
+    }
+}
+
+int main()
+{
+    test_warp_distributions();
+    test_pdf_integrals();
+    test_onb();
+    test_spherical_rectangle();
+
+    if (failures)
+        std::printf("%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
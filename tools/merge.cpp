@@ -0,0 +1,155 @@
+// Merges the parts of a split render into the final image.
+// Each part is the checkpoint of one Raytracer run (--checkpoint), covering a region of the image,
+// a range of sample numbers, or both. The pixel estimates of all parts are added up: sample splits
+// become a sum weighted by each part's sample count, and regions are stitched, since a part holds
+// no samples outside its region. Color sums are fixed point and random numbers are keyed by pixel and
+// sample, so parts rendered with the same --seed merge bit for bit to the image of a single process render.
+// Parts with another seed or sampler than the first are refused, and so are two parts whose regions
+// intersect and whose sample ranges overlap, since the pixels they share would count the same samples twice.
+//
+// Run: build/Raytracer_Merge output.(png|ppm|pfm|raw) part.ckpt [part.ckpt ...]
+//      The merged estimates can also be kept as a checkpoint to resume from: output.ckpt
+//      (only if the parts leave no gaps in the sample numbers or the region it records, see resumable)
+
+#include "utility.h"
+#include "checkpoint.h"
+#include "image_writer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//A resumed render draws sample first_sample + samples next in each pixel of its region, so a merged checkpoint
+//can only be resumed if every pixel of the region holds exactly the samples [first_sample, first_sample + samples).
+//The parts covering each pixel must continue one another's sample ranges from first_sample, and all but the last
+//of them must have finished there. Returns false, after reporting the first pixel that breaks this on std::cerr.
+static bool resumable(const checkpoint_header& merged, const std::vector<checkpoint_header>& headers,
+                      const std::vector<std::vector<int>>& part_samples, char* names[])
+{
+    std::vector<int> covering;
+    for (int y = merged.y0; y < merged.y1; y++) {
+        for (int x = merged.x0; x < merged.x1; x++) {
+            covering.clear();
+            for (int k = 0; k < int(headers.size()); k++)
+                if (x >= headers[k].x0 && x < headers[k].x1 && y >= headers[k].y0 && y < headers[k].y1)
+                    covering.push_back(k);
+            std::sort(covering.begin(), covering.end(), [&](int a, int b) { return headers[a].first_sample < headers[b].first_sample; });
+
+            int next = merged.first_sample;
+            for (size_t i = 0; i < covering.size(); i++) {
+                const checkpoint_header& part = headers[covering[i]];
+                int held = part_samples[covering[i]][size_t(y) * merged.width + x];
+                if (part.first_sample != next) {
+                    std::cerr << "ERROR: The parts leave out samples [" << next << ", " << part.first_sample << ") of pixel "
+                              << x << ", " << y << ", so the merged checkpoint could not be resumed. Merge to an image instead.\n";
+                    return false;
+                }
+                if (i + 1 < covering.size() && held != part.last_sample - part.first_sample) {
+                    std::cerr << "ERROR: '" << names[covering[i]] << "' holds only " << held << " of its samples [" << part.first_sample
+                              << ", " << part.last_sample << ") of pixel " << x << ", " << y
+                              << ", so the merged checkpoint could not be resumed. Merge to an image instead.\n";
+                    return false;
+                }
+                next = part.last_sample;
+            }
+            if (covering.empty()) {
+                std::cerr << "ERROR: No part covers pixel " << x << ", " << y << " of the merged region, so the merged checkpoint"
+                          << " could not be resumed. Merge to an image instead.\n";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " output part [part ...]\n";
+        return 1;
+    }
+    std::string output = argv[1];
+    bool checkpoint_output = ends_with(output, ".ckpt");
+
+    checkpoint_header merged_header;
+    std::vector<checkpoint_header> headers;
+    std::vector<std::vector<int>> part_samples; //of every pixel in every part, for a checkpoint output
+    std::vector<pixel_estimate> merged;
+    for (int k = 2; k < argc; k++) {
+        checkpoint_header header;
+        std::vector<pixel_estimate> part;
+        checkpoint_status status = read_estimates(argv[k], header, part);
+        if (status == checkpoint_status::missing)
+            std::cerr << "ERROR: Could not read '" << argv[k] << "'.\n";
+        if (status != checkpoint_status::loaded)
+            return 1;
+
+        headers.push_back(header);
+        if (checkpoint_output) {
+            part_samples.emplace_back(part.size());
+            for (size_t p = 0; p < part.size(); p++)
+                part_samples.back()[p] = part[p].samples;
+        }
+        if (merged.empty()) {
+            merged_header = header;
+            merged = std::move(part);
+            continue;
+        }
+        if (header.width != merged_header.width || header.height != merged_header.height ||
+            header.fingerprint != merged_header.fingerprint) {
+            std::cerr << "ERROR: '" << argv[k] << "' is part of a different render than '" << argv[2] << "'.\n";
+            return 1;
+        }
+        if (header.seed != merged_header.seed || std::strcmp(header.sampler, merged_header.sampler) != 0) {
+            std::cerr << "ERROR: '" << argv[k] << "' was rendered with seed " << header.seed << " and sampler '" << header.sampler
+                      << "', but '" << argv[2] << "' with seed " << merged_header.seed << " and sampler '" << merged_header.sampler << "'.\n";
+            return 1;
+        }
+        for (int other = 0; other + 1 < int(headers.size()); other++) {
+            const checkpoint_header& earlier = headers[other];
+            if (header.overlaps(earlier) && header.first_sample < earlier.last_sample && earlier.first_sample < header.last_sample) {
+                std::cerr << "ERROR: '" << argv[k] << "' and '" << argv[2 + other] << "' both hold samples of the same pixels: samples ["
+                          << header.first_sample << ", " << header.last_sample << ") and [" << earlier.first_sample << ", "
+                          << earlier.last_sample << ") of overlapping regions.\n";
+                return 1;
+            }
+        }
+        for (size_t p = 0; p < merged.size(); p++)
+            merged[p].merge(part[p]);
+
+        //the merged checkpoint covers all the parts' samples and regions
+        merged_header.first_sample = std::min(merged_header.first_sample, header.first_sample);
+        merged_header.last_sample = std::max(merged_header.last_sample, header.last_sample);
+        merged_header.x0 = std::min(merged_header.x0, header.x0);
+        merged_header.y0 = std::min(merged_header.y0, header.y0);
+        merged_header.x1 = std::max(merged_header.x1, header.x1);
+        merged_header.y1 = std::max(merged_header.y1, header.y1);
+    }
+
+    int width = merged_header.width, height = merged_header.height;
+    long long samples = 0, empty_pixels = 0;
+    for (const pixel_estimate& pixel : merged) {
+        samples += pixel.samples;
+        empty_pixels += pixel.samples == 0;
+    }
+    if (empty_pixels > 0)
+        std::clog << "Warning: " << empty_pixels << " pixels have no samples in any part.\n";
+    std::clog << "Merged " << argc - 2 << " parts, " << double(samples) / merged.size() << " samples per pixel\n";
+
+    if (checkpoint_output) {
+        if (!resumable(merged_header, headers, part_samples, argv + 2))
+            return 1;
+        Checkpoint_Writer writer(output, merged_header, height, merged, 0);
+        return writer.write() ? 0 : 1;
+    }
+
+    std::vector<float> rgb(merged.size() * 3);
+    for (size_t p = 0; p < merged.size(); p++) {
+        color mean = merged[p].mean();
+        rgb[3 * p] = float(mean.r);
+        rgb[3 * p + 1] = float(mean.g);
+        rgb[3 * p + 2] = float(mean.b);
+    }
+    return write_image_file(output, width, height, rgb) ? 0 : 1;
+}